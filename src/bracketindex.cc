@@ -0,0 +1,386 @@
+#include <algorithm>
+#include "pane.hh"
+
+namespace {
+constexpr size_t BRACKET_SHARD_ROWS = 16384;
+// blocks are cut in two when an edit would make them twice this
+constexpr size_t BRACKET_BLOCK_ROWS = 256;
+const std::string OPENERS{"([{"};
+const std::string CLOSERS{")]}"};
+
+BracketDepth combine(const BracketDepth& a, const BracketDepth& b) {
+  return BracketDepth{a.sum + b.sum,
+                      std::min(a.minPrefix, a.sum + b.minPrefix)};
+}
+BracketDepth combineRows(const std::vector<BracketDepth>& rows) {
+  BracketDepth depth{};
+  for (const BracketDepth& row : rows) {
+    depth = combine(depth, row);
+  }
+  return depth;
+}
+bool isPair(char open, char close) {
+  size_t kind = OPENERS.find(open);
+  return kind != std::string::npos && CLOSERS[kind] == close;
+}
+}  // namespace
+
+void BracketIndex::bufferLoaded(const EditBuffer& buf, const std::string&) {
+  std::vector<BracketDepth> rows(buf.lines.size());
+  size_t shardCount =
+      (buf.lines.size() + BRACKET_SHARD_ROWS - 1) / BRACKET_SHARD_ROWS;
+  forEachShard(shardCount, [&rows, &buf](size_t shard) {
+    size_t end = std::min((shard + 1) * BRACKET_SHARD_ROWS, buf.lines.size());
+    for (size_t i = shard * BRACKET_SHARD_ROWS; i < end; i++) {
+      rows[i] = measure(buf.lines[i]);
+    }
+  });
+  root = buildBlocks(rows);
+}
+void BracketIndex::linesChanged(const EditBuffer& buf,
+                                size_t row,
+                                size_t removed,
+                                size_t inserted) {
+  if (removed == inserted) {
+    for (size_t i = row; i < row + inserted; i++) {
+      setRow(i, measure(buf.lines[i]));
+    }
+    return;
+  }
+  std::vector<BracketDepth> rows(inserted);
+  for (size_t i = 0; i < inserted; i++) {
+    rows[i] = measure(buf.lines[row + i]);
+  }
+  spliceRows(row, removed, std::move(rows));
+}
+void BracketIndex::linesRotated(const EditBuffer& buf,
+                                size_t first,
+                                size_t,
+                                size_t last) {
+  for (size_t i = first; i < last; i++) {
+    setRow(i, measure(buf.lines[i]));
+  }
+}
+bool BracketIndex::findMatch(const EditBuffer& buf,
+                             BufferPosition position,
+                             BufferPosition& match) const {
+  if (position.row >= buf.lines.size() ||
+      position.col >= buf.lines[position.row].size())
+    return false;
+  char bracket = buf.lines[position.row][position.col];
+  if (OPENERS.find(bracket) != std::string::npos) {
+    position.col++;
+    if (!findForward(buf, position, match))
+      return false;
+    return isPair(bracket, buf.lines[match.row][match.col]);
+  }
+  if (CLOSERS.find(bracket) != std::string::npos) {
+    if (!findBackward(buf, position, match))
+      return false;
+    return isPair(buf.lines[match.row][match.col], bracket);
+  }
+  return false;
+}
+bool BracketIndex::findEnclosing(const EditBuffer& buf,
+                                 BufferPosition position,
+                                 BufferPosition& open,
+                                 BufferPosition& close) const {
+  if (position.row >= buf.lines.size())
+    return false;
+  position.col = std::min(position.col, buf.lines[position.row].size());
+  return findBackward(buf, position, open) &&
+         findForward(buf, position, close) &&
+         isPair(buf.lines[open.row][open.col],
+                buf.lines[close.row][close.col]);
+}
+
+BracketDepth BracketIndex::measure(const std::string& line) {
+  BracketDepth depth{};
+  for (char c : line) {
+    if (c == '(' || c == '[' || c == '{') {
+      depth.sum++;
+    } else if (c == ')' || c == ']' || c == '}') {
+      depth.sum--;
+      depth.minPrefix = std::min(depth.minPrefix, depth.sum);
+    }
+  }
+  return depth;
+}
+void BracketIndex::setRow(size_t row, BracketDepth depth) {
+  std::vector<Block*> path{};
+  Block* block = findBlock(row, path);
+  block->rows[row] = depth;
+  block->depth = combineRows(block->rows);
+  for (size_t i = path.size(); i-- > 0;) {
+    update(*path[i]);
+  }
+}
+void BracketIndex::spliceRows(size_t row,
+                              size_t removed,
+                              std::vector<BracketDepth>&& inserted) {
+  std::vector<Block*> path{};
+  size_t index = row;
+  Block* block = root != nullptr ? findBlock(index, path) : nullptr;
+  if (block != nullptr && index + removed <= block->rows.size()) {
+    size_t newSize = block->rows.size() - removed + inserted.size();
+    if (newSize > 0 && newSize <= 2 * BRACKET_BLOCK_ROWS) {
+      // inside one block, which is edited in place
+      auto first = block->rows.begin() + index;
+      block->rows.erase(first, first + removed);
+      block->rows.insert(block->rows.begin() + index, inserted.begin(),
+                         inserted.end());
+      block->depth = combineRows(block->rows);
+      for (size_t i = path.size(); i-- > 0;) {
+        update(*path[i]);
+      }
+      return;
+    }
+  }
+  std::unique_ptr<Block> left{}, middle{}, right{};
+  splitRows(std::move(root), row, left, right);
+  splitRows(std::move(right), removed, middle, right);
+  middle = nullptr;
+  root = merge(merge(std::move(left), buildBlocks(inserted)),
+               std::move(right));
+}
+std::unique_ptr<BracketIndex::Block> BracketIndex::makeBlock(
+    std::vector<BracketDepth>&& rows) {
+  // splitmix64 of a counter, random enough to keep the treap balanced
+  size_t z = priorityState += 0x9e3779b97f4a7c15;
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+  auto block = std::make_unique<Block>();
+  block->priority = z ^ (z >> 31);
+  block->rows = std::move(rows);
+  block->depth = combineRows(block->rows);
+  update(*block);
+  return block;
+}
+std::unique_ptr<BracketIndex::Block> BracketIndex::buildBlocks(
+    const std::vector<BracketDepth>& rows) {
+  // in O(n): the right spine of the treap so far holds the blocks a new one
+  // can go under
+  std::unique_ptr<Block> built{};
+  std::vector<Block*> spine{};
+  for (size_t start = 0; start < rows.size(); start += BRACKET_BLOCK_ROWS) {
+    auto first = rows.begin() + start;
+    std::unique_ptr<Block> block = makeBlock(std::vector<BracketDepth>(
+        first, first + std::min(BRACKET_BLOCK_ROWS, rows.size() - start)));
+    while (spine.size() > 0 && spine.back()->priority < block->priority) {
+      update(*spine.back());
+      spine.pop_back();
+    }
+    std::unique_ptr<Block>& slot =
+        spine.size() > 0 ? spine.back()->right : built;
+    block->left = std::move(slot);
+    slot = std::move(block);
+    spine.push_back(slot.get());
+  }
+  while (spine.size() > 0) {
+    update(*spine.back());
+    spine.pop_back();
+  }
+  return built;
+}
+BracketIndex::Block* BracketIndex::findBlock(size_t& row,
+                                             std::vector<Block*>& path) const {
+  for (Block* block = root.get(); block != nullptr;) {
+    path.push_back(block);
+    size_t leftRows = block->left != nullptr ? block->left->rowCount : 0;
+    if (row < leftRows) {
+      block = block->left.get();
+      continue;
+    }
+    row -= leftRows;
+    if (row < block->rows.size() ||
+        (row == block->rows.size() && block->right == nullptr))
+      return block;
+    row -= block->rows.size();
+    block = block->right.get();
+  }
+  return nullptr;
+}
+void BracketIndex::splitRows(std::unique_ptr<Block> block,
+                             size_t rows,
+                             std::unique_ptr<Block>& left,
+                             std::unique_ptr<Block>& right) {
+  // the treap is only O(log n) deep, so recursing down it is safe
+  if (block == nullptr) {
+    left = nullptr;
+    right = nullptr;
+    return;
+  }
+  size_t leftRows = block->left != nullptr ? block->left->rowCount : 0;
+  if (rows <= leftRows) {
+    splitRows(std::move(block->left), rows, left, block->left);
+    update(*block);
+    right = std::move(block);
+  } else if (rows >= leftRows + block->rows.size()) {
+    splitRows(std::move(block->right), rows - leftRows - block->rows.size(),
+              block->right, right);
+    update(*block);
+    left = std::move(block);
+  } else {
+    auto cut = block->rows.begin() + (rows - leftRows);
+    std::unique_ptr<Block> tail =
+        makeBlock(std::vector<BracketDepth>(cut, block->rows.end()));
+    block->rows.erase(cut, block->rows.end());
+    block->depth = combineRows(block->rows);
+    right = merge(std::move(tail), std::move(block->right));
+    update(*block);
+    left = std::move(block);
+  }
+}
+std::unique_ptr<BracketIndex::Block> BracketIndex::merge(
+    std::unique_ptr<Block> left,
+    std::unique_ptr<Block> right) {
+  if (left == nullptr)
+    return right;
+  if (right == nullptr)
+    return left;
+  if (left->priority > right->priority) {
+    left->right = merge(std::move(left->right), std::move(right));
+    update(*left);
+    return left;
+  }
+  right->left = merge(std::move(left), std::move(right->left));
+  update(*right);
+  return right;
+}
+void BracketIndex::update(Block& block) {
+  block.rowCount = block.rows.size();
+  block.subtreeDepth = block.depth;
+  if (block.left != nullptr) {
+    block.rowCount += block.left->rowCount;
+    block.subtreeDepth = combine(block.left->subtreeDepth, block.subtreeDepth);
+  }
+  if (block.right != nullptr) {
+    block.rowCount += block.right->rowCount;
+    block.subtreeDepth =
+        combine(block.subtreeDepth, block.right->subtreeDepth);
+  }
+}
+bool BracketIndex::findForward(const EditBuffer& buf,
+                               BufferPosition from,
+                               BufferPosition& match) const {
+  // the depth drops below zero at the closer of the pair from is inside
+  long depth = 0;
+  if (scanForward(buf.lines[from.row], from.col, depth, match.col)) {
+    match.row = from.row;
+    return true;
+  }
+  size_t row = descendForward(root.get(), 0, from.row + 1, depth);
+  if (row == std::string::npos)
+    return false;
+  match.row = row;
+  return scanForward(buf.lines[row], 0, depth, match.col);
+}
+bool BracketIndex::findBackward(const EditBuffer& buf,
+                                BufferPosition from,
+                                BufferPosition& match) const {
+  long depth = 0;
+  if (scanBackward(buf.lines[from.row], from.col, depth, match.col)) {
+    match.row = from.row;
+    return true;
+  }
+  size_t row = descendBackward(root.get(), 0, from.row, depth);
+  if (row == std::string::npos)
+    return false;
+  match.row = row;
+  return scanBackward(buf.lines[row], buf.lines[row].size(), depth,
+                      match.col);
+}
+bool BracketIndex::scanForward(const std::string& line,
+                               size_t col,
+                               long& depth,
+                               size_t& match) {
+  for (size_t i = col; i < line.size(); i++) {
+    char c = line[i];
+    if (c == '(' || c == '[' || c == '{') {
+      depth++;
+    } else if ((c == ')' || c == ']' || c == '}') && --depth < 0) {
+      match = i;
+      return true;
+    }
+  }
+  return false;
+}
+bool BracketIndex::scanBackward(const std::string& line,
+                                size_t col,
+                                long& depth,
+                                size_t& match) {
+  for (size_t i = col; i > 0; i--) {
+    char c = line[i - 1];
+    if (c == ')' || c == ']' || c == '}') {
+      depth++;
+    } else if ((c == '(' || c == '[' || c == '{') && --depth < 0) {
+      match = i - 1;
+      return true;
+    }
+  }
+  return false;
+}
+size_t BracketIndex::descendForward(const Block* block,
+                                    size_t low,
+                                    size_t from,
+                                    long& depth) {
+  // the first row at or after from where the depth drops below zero. blocks
+  // and subtrees it can't be in are stepped over whole
+  if (block == nullptr || low + block->rowCount <= from)
+    return std::string::npos;
+  if (low >= from && depth + block->subtreeDepth.minPrefix >= 0) {
+    depth += block->subtreeDepth.sum;
+    return std::string::npos;
+  }
+  size_t row = descendForward(block->left.get(), low, from, depth);
+  if (row != std::string::npos)
+    return row;
+  low += block->left != nullptr ? block->left->rowCount : 0;
+  if (low >= from && depth + block->depth.minPrefix >= 0) {
+    depth += block->depth.sum;
+  } else {
+    for (size_t i = from > low ? from - low : 0; i < block->rows.size(); i++) {
+      if (depth + block->rows[i].minPrefix < 0)
+        return low + i;
+      depth += block->rows[i].sum;
+    }
+  }
+  return descendForward(block->right.get(), low + block->rows.size(), from,
+                        depth);
+}
+size_t BracketIndex::descendBackward(const Block* block,
+                                     size_t low,
+                                     size_t before,
+                                     long& depth) {
+  // the same from the right. read backwards, the depth falls over a span by
+  // as much as its deepest suffix opens, sum - minPrefix
+  if (block == nullptr || low >= before)
+    return std::string::npos;
+  const BracketDepth& span = block->subtreeDepth;
+  if (low + block->rowCount <= before &&
+      depth - (span.sum - span.minPrefix) >= 0) {
+    depth -= span.sum;
+    return std::string::npos;
+  }
+  size_t leftRows = block->left != nullptr ? block->left->rowCount : 0;
+  size_t blockLow = low + leftRows;
+  size_t row = descendBackward(block->right.get(),
+                               blockLow + block->rows.size(), before, depth);
+  if (row != std::string::npos)
+    return row;
+  const BracketDepth& own = block->depth;
+  if (blockLow + block->rows.size() <= before &&
+      depth - (own.sum - own.minPrefix) >= 0) {
+    depth -= own.sum;
+  } else {
+    size_t end = std::min(block->rows.size(),
+                          before > blockLow ? before - blockLow : 0);
+    for (size_t i = end; i-- > 0;) {
+      const BracketDepth& rowDepth = block->rows[i];
+      if (depth - (rowDepth.sum - rowDepth.minPrefix) < 0)
+        return blockLow + i;
+      depth -= rowDepth.sum;
+    }
+  }
+  return descendBackward(block->left.get(), low, before, depth);
+}
@@ -1,55 +1,52 @@
-#include <iostream>
 #include "pane.hh"
 
 BufferCursor::BufferCursor() {}
 BufferCursor::BufferCursor(BufferPosition& pos) : position{pos} {}
 
 void BufferCursor::moveSet(int col, int row) {
-  std::cout << "moveset: " << col << ", " << row << std::endl;
   position.row = row;
   position.col = col;
   tailPosition = position;
 }
 void BufferCursor::selectSet(int col, int row) {
-  std::cout << "selectSet: " << col << ", " << row << std::endl;
   position.row = row;
   position.col = col;
 }
 
-void BufferCursor::selectUp(const EditBuffer& buf) {
+void BufferCursor::selectUp(const EditBuffer& buf, const FoldSet& folds) {
   if (buf.lines.size() == 0) {
     selectSet(0, 0);
     return;
   }
   int newX = position.col;
-  int newY = position.row - 1;
+  int newY = folds.getVisibleRow(position.row) - 1;
   if (newY < 0) {
     selectSet(0, 0);
     return;
   }
   if (newY >= (int)buf.lines.size() - 1)
     newY = std::max((int)buf.lines.size() - 2, 0);
-  selectSet(newX, newY);
+  selectSet(newX, folds.getVisibleRow(newY));
 }
-void BufferCursor::selectDown(const EditBuffer& buf) {
+void BufferCursor::selectDown(const EditBuffer& buf, const FoldSet& folds) {
   if (buf.lines.size() == 0) {
     selectSet(0, 0);
     return;
   }
   int newX = position.col;
-  int newY = position.row + 1;
+  int newY = folds.getNextRow(folds.getVisibleRow(position.row));
   if (newY < 0) {
     newY = std::min(1, (int)buf.lines.size());
     selectSet(newX, newY);
     return;
   }
   if (newY > (int)buf.lines.size() - 1) {
-    newY = buf.lines.size() - 1;
+    newY = folds.getVisibleRow(buf.lines.size() - 1);
     newX = buf.lines[newY].size();
   }
   selectSet(newX, newY);
 }
-void BufferCursor::selectLeft(const EditBuffer& buf) {
+void BufferCursor::selectLeft(const EditBuffer& buf, const FoldSet& folds) {
   if (buf.lines.size() == 0) {
     selectSet(0, 0);
     return;
@@ -73,11 +70,11 @@ void BufferCursor::selectLeft(const EditBuffer& buf) {
     selectSet(0, 0);
     return;
   }
-  newY--;
+  newY = folds.getVisibleRow(newY - 1);
   newX = buf.lines[newY].size();
   selectSet(newX, newY);
 }
-void BufferCursor::selectRight(const EditBuffer& buf) {
+void BufferCursor::selectRight(const EditBuffer& buf, const FoldSet& folds) {
   if (buf.lines.size() == 0) {
     selectSet(0, 0);
     return;
@@ -94,64 +91,74 @@ void BufferCursor::selectRight(const EditBuffer& buf) {
     return;
   }
   // handle past EOL
-  if (newY == (int)buf.lines.size() - 1) {
+  if (folds.getNextRow(newY) >= buf.lines.size()) {
     // we are already at the bottom, just reset X to EOL;
     newX = (int)buf.lines[newY].size();
     selectSet(newX, newY);
     return;
   }
-  newY++;
+  newY = folds.getNextRow(newY);
   newX = 0;
   selectSet(newX, newY);
 }
-void BufferCursor::selectPageUp(int termHeight) {
-  int nextRow = (int)position.row - termHeight / 2;
+void BufferCursor::selectPageUp(const FoldSet& folds, int termHeight) {
+  // pages count screen rows, so folded rows are skipped
+  int nextRow = (int)folds.getScreenRow(position.row) - termHeight / 2;
   if (nextRow < 0) {
     selectSet(0, 0);
   } else {
-    selectSet(position.col, nextRow);
+    selectSet(position.col, folds.getRow(nextRow));
   }
 }
-void BufferCursor::selectPageDown(const EditBuffer& buf, int termHeight) {
+void BufferCursor::selectPageDown(const EditBuffer& buf,
+                                  const FoldSet& folds,
+                                  int termHeight) {
   int bufSize = buf.lines.size();
   if (bufSize == 0)
     return;
-  int nextRow = position.row + termHeight / 2;
-  if (nextRow > bufSize - 1) {
-    selectSet(buf.lines[bufSize - 1].size(), bufSize - 1);
+  int nextRow = folds.getScreenRow(position.row) + termHeight / 2;
+  if (nextRow > (int)folds.getScreenRow(bufSize - 1)) {
+    int lastRow = folds.getVisibleRow(bufSize - 1);
+    selectSet(buf.lines[lastRow].size(), lastRow);
   } else {
-    selectSet(position.col, nextRow);
+    selectSet(position.col, folds.getRow(nextRow));
   }
 }
 void BufferCursor::selectHome() {
   selectSet(0, position.row);
 }
 void BufferCursor::selectEnd(const EditBuffer& buf) {
+  if (buf.lines.size() == 0) {
+    selectSet(0, 0);
+    return;
+  }
   selectSet(buf.lines[position.row].size(), position.row);
 }
 
-void BufferCursor::moveUp(const EditBuffer& buf) {
-  selectUp(buf);
+void BufferCursor::moveUp(const EditBuffer& buf, const FoldSet& folds) {
+  selectUp(buf, folds);
   tailPosition = position;
 }
-void BufferCursor::moveDown(const EditBuffer& buf) {
-  selectDown(buf);
+void BufferCursor::moveDown(const EditBuffer& buf, const FoldSet& folds) {
+  selectDown(buf, folds);
   tailPosition = position;
 }
-void BufferCursor::moveLeft(const EditBuffer& buf) {
-  selectLeft(buf);
+void BufferCursor::moveLeft(const EditBuffer& buf, const FoldSet& folds) {
+  selectLeft(buf, folds);
   tailPosition = position;
 }
-void BufferCursor::moveRight(const EditBuffer& buf) {
-  selectRight(buf);
+void BufferCursor::moveRight(const EditBuffer& buf, const FoldSet& folds) {
+  selectRight(buf, folds);
   tailPosition = position;
 }
-void BufferCursor::movePageUp(int termHeight) {
-  selectPageUp(termHeight);
+void BufferCursor::movePageUp(const FoldSet& folds, int termHeight) {
+  selectPageUp(folds, termHeight);
   tailPosition = position;
 }
-void BufferCursor::movePageDown(const EditBuffer& buf, int termHeight) {
-  selectPageDown(buf, termHeight);
+void BufferCursor::movePageDown(const EditBuffer& buf,
+                                const FoldSet& folds,
+                                int termHeight) {
+  selectPageDown(buf, folds, termHeight);
   tailPosition = position;
 }
 void BufferCursor::moveHome() {
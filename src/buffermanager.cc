@@ -0,0 +1,221 @@
+#include <errno.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <iostream>
+#include "pane.hh"
+
+BufferTab::BufferTab(const std::string& filename) : filename{filename} {
+  buf.addObserver(&wordIndex);
+  buf.addObserver(&origins);
+  buf.addObserver(&lineIndex);
+  buf.addObserver(&versions);
+  buf.addObserver(&folds);
+  buf.addObserver(&brackets);
+}
+BufferTab::~BufferTab() {
+  truncateHistory(0);
+}
+bool BufferTab::isModified() const {
+  return opStackPosition != savedOpStackPosition;
+}
+bool BufferTab::isDiskChanged(const struct stat& st) const {
+  return st.st_size != diskSize ||
+         st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec != diskMtime;
+}
+void BufferTab::stampDisk(const struct stat& st) {
+  diskSize = st.st_size;
+  diskMtime = st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+}
+void BufferTab::truncateHistory(size_t size) {
+  for (size_t i = size; i < opStack.size(); i++) {
+    MemoryUsage usage = opStack[i].getMemoryUsage();
+    MemoryStats::add(MS_UNDO, -usage.bytes, -usage.allocations);
+    historyBytes -= usage.bytes;
+  }
+  opStack.erase(opStack.begin() + std::min(size, opStack.size()),
+                opStack.end());
+}
+
+void BufferTab::pushOperation(BufferOperation&& bufOp) {
+  if (opStackPosition < (int)opStack.size()) {
+    truncateHistory(opStackPosition);
+    // the saved state was undone and can no longer be reached
+    if (savedOpStackPosition > opStackPosition)
+      savedOpStackPosition = -1;
+    if (savingOpStackPosition > opStackPosition)
+      savingOpStackPosition = -1;
+  }
+  journal.recordOperation(bufOp);
+  opStack.push_back(std::move(bufOp));
+  opStackPosition++;
+  MemoryUsage usage = opStack.back().getMemoryUsage();
+  MemoryStats::add(MS_UNDO, usage.bytes, usage.allocations);
+  historyBytes += usage.bytes;
+}
+size_t BufferTab::getMemoryUsage() const {
+  return buf.getMemoryUsage() + historyBytes + versions.getMemoryUsage();
+}
+const BufferOperation* BufferTab::undo() {
+  if (opStackPosition <= 0)
+    return nullptr;
+  journal.recordUndo();
+  opStackPosition--;
+  buf.undoBufferOperation(opStack[opStackPosition]);
+  return &opStack[opStackPosition];
+}
+const BufferOperation* BufferTab::redo() {
+  if (opStackPosition >= (int)opStack.size())
+    return nullptr;
+  journal.recordRedo();
+  // use a copy so we ignore changes to oCursors/removedTexts/removedSlices
+  BufferOperation bufCopy = opStack[opStackPosition];
+  bufCopy.oCursors.clear();
+  bufCopy.removedTexts.clear();
+  bufCopy.removedSlices.clear();
+  buf.doBufferOperation(bufCopy);
+  return &opStack[opStackPosition++];
+}
+size_t BufferTab::recover() {
+  std::vector<JournalRecord> records{};
+  long long validLength = Journal::read(filename, records);
+  // the journal isn't open yet, so replaying doesn't record anything
+  for (JournalRecord& record : records) {
+    switch (record.type) {
+      case JR_DO:
+        buf.doBufferOperation(record.bufOp);
+        cursors.assign(record.bufOp.oCursors.begin(),
+                       record.bufOp.oCursors.end());
+        pushOperation(std::move(record.bufOp));
+        break;
+      case JR_UNDO:
+        if (const BufferOperation* bufOp = undo())
+          cursors.assign(bufOp->iCursors.begin(), bufOp->iCursors.end());
+        break;
+      case JR_REDO:
+        if (const BufferOperation* bufOp = redo())
+          cursors.assign(bufOp->oCursors.begin(), bufOp->oCursors.end());
+        break;
+    }
+  }
+  journal.open(filename, validLength);
+  return records.size();
+}
+void BufferTab::rebaseJournal() {
+  if (savedOpStackPosition < 0 || opStackPosition < savedOpStackPosition) {
+    // the buffer can't be reached from the saved file by the history alone
+    std::cout << "ERROR:rebaseJournal history diverged from the saved file, "
+                 "journal stopped until the next save"
+              << std::endl;
+    journal.remove();
+    return;
+  }
+  journal.rebase(filename, opStack, savedOpStackPosition,
+                 opStack.size() - opStackPosition);
+}
+
+BufferManager::BufferManager(size_t memoryBudget)
+    : memoryBudget{memoryBudget} {}
+
+size_t BufferManager::openTab(const std::string& filename) {
+  if (filename.size() > 0) {
+    for (size_t i = 0; i < tabs.size(); i++) {
+      if (tabs[i]->filename == filename)
+        return i;
+    }
+  }
+  tabs.push_back(std::make_unique<BufferTab>(filename));
+  // a new file has nothing to load
+  tabs.back()->isLoaded = filename.size() == 0;
+  return tabs.size() - 1;
+}
+void BufferManager::closeTab(size_t index) {
+  tabs.erase(tabs.begin() + index);
+  if (tabs.size() == 0)
+    openTab("");
+  if (activeIndex > index || activeIndex >= tabs.size())
+    activeIndex = activeIndex > 0 ? activeIndex - 1 : 0;
+}
+BufferTab* BufferManager::activateTab(size_t index) {
+  activeIndex = index;
+  BufferTab& tab = *tabs[index];
+  tab.lastViewed = ++viewCounter;
+  if (!tab.isLoaded)
+    loadTab(tab);
+  enforceMemoryBudget();
+  return &tab;
+}
+BufferTab* BufferManager::getTab(size_t index) const {
+  return tabs[index].get();
+}
+size_t BufferManager::indexOf(const BufferTab* tab) const {
+  for (size_t i = 0; i < tabs.size(); i++) {
+    if (tabs[i].get() == tab)
+      return i;
+  }
+  return tabs.size();
+}
+size_t BufferManager::getActiveIndex() const {
+  return activeIndex;
+}
+size_t BufferManager::size() const {
+  return tabs.size();
+}
+
+void BufferManager::loadTab(BufferTab& tab) {
+  struct stat st {};
+  bool isOpened = stat(tab.filename.c_str(), &st) == 0;
+  if (tab.isDiskChanged(st)) {
+    // the file changed while unloaded, so the undo history no longer applies
+    tab.truncateHistory(0);
+    tab.opStackPosition = 0;
+    tab.savedOpStackPosition = 0;
+    tab.cursors = {BufferCursor{}};
+    tab.bufOffset = BufferPosition{};
+  }
+  if (isOpened)
+    isOpened = tab.buf.loadFromFile(tab.filename);
+  if (!isOpened) {
+    // the tab stays open but empty, and saving it creates the file
+    tab.loadError = "can't open: " + std::string{strerror(errno)};
+  }
+  if (tab.opStack.size() == 0)
+    tab.recoveredCount = tab.recover();
+  tab.isLoaded = true;
+  tab.stampDisk(st);
+  std::cout << "loaded tab: " << tab.filename << std::endl;
+}
+void BufferManager::unloadTab(BufferTab& tab) {
+  // the disk stamp stays the one taken at load or save, so a change made
+  // while the tab was loaded still drops the history when it's loaded again
+  tab.buf.unload();
+  tab.isLoaded = false;
+  std::cout << "unloaded tab: " << tab.filename << std::endl;
+}
+void BufferManager::enforceMemoryBudget() {
+  size_t usage = 0;
+  std::vector<BufferTab*> candidates{};
+  for (size_t i = 0; i < tabs.size(); i++) {
+    BufferTab& tab = *tabs[i];
+    if (!tab.isLoaded)
+      continue;
+    usage += tab.getMemoryUsage();
+    if (i == activeIndex || tab.viewCount > 0)
+      continue;
+    if (!tab.isModified() && tab.filename.size() > 0 &&
+        !tab.follower.isFollowing())
+      candidates.push_back(&tab);
+  }
+  std::sort(candidates.begin(), candidates.end(),
+            [](const BufferTab* a, const BufferTab* b) {
+              return a->lastViewed < b->lastViewed;
+            });
+  for (BufferTab* tab : candidates) {
+    if (usage <= memoryBudget)
+      break;
+    // the history stays for when it's loaded again, and snapshots of it are
+    // kept by whoever holds them
+    usage -= tab->buf.getMemoryUsage();
+    unloadTab(*tab);
+  }
+}
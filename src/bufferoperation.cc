@@ -2,5 +2,37 @@
 
 BufferOperation::BufferOperation(BufOpType ot,
                                  const std::vector<BufferCursor>& cursors,
-                                 const std::vector<std::string>& texts)
-    : opType{ot}, iCursors{cursors}, insertTexts{texts} {}
+                                 const std::vector<std::string>& texts,
+                                 std::pmr::memory_resource* resource)
+    : opType{ot},
+      iCursors{cursors.begin(), cursors.end(), resource},
+      insertTexts{texts.begin(), texts.end(), resource},
+      oCursors{resource},
+      removedTexts{resource} {}
+
+const std::string& BufferOperation::getInsertText(size_t i) const {
+  return insertTexts.size() == 1 ? insertTexts[0] : insertTexts[i];
+}
+
+MemoryUsage BufferOperation::getMemoryUsage() const {
+  // the operation itself lives in the undo stack's array
+  MemoryUsage usage{(long long)sizeof(BufferOperation), 0, 0};
+  auto addArray = [&usage](size_t capacity, size_t elementSize) {
+    usage.bytes += capacity * elementSize;
+    usage.allocations += capacity > 0;
+  };
+  addArray(iCursors.capacity(), sizeof(BufferCursor));
+  addArray(oCursors.capacity(), sizeof(BufferCursor));
+  addArray(insertTexts.capacity(), sizeof(std::string));
+  addArray(removedTexts.capacity(), sizeof(std::string));
+  addArray(insertSlices.capacity(), sizeof(LineSlice));
+  addArray(removedSlices.capacity(), sizeof(LineSlice));
+  std::string empty{};
+  for (const auto* texts : {&insertTexts, &removedTexts}) {
+    for (const std::string& text : *texts) {
+      if (text.capacity() > empty.capacity())
+        addArray(text.capacity() + 1, 1);
+    }
+  }
+  return usage;
+}
@@ -0,0 +1,220 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <algorithm>
+#include "pane.hh"
+
+namespace {
+// every row separator points at the same byte
+char NEWLINE[]{'\n'};
+// shorter runs of unchanged rows are cheaper to write from memory
+constexpr long long MIN_COPIED_EXTENT = 64 * 1024;
+constexpr size_t COPY_BUFFER_SIZE = 1024 * 1024;
+
+// writes all of iov, resuming after short writes
+bool writeAll(int fd, std::vector<iovec>& iov, std::atomic<size_t>& counter) {
+  size_t i = 0;
+  while (i < iov.size()) {
+    ssize_t written = writev(fd, &iov[i], std::min(iov.size() - i,
+                                                   (size_t)IOV_MAX));
+    if (written < 0) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    counter += written;
+    while (i < iov.size() && (size_t)written >= iov[i].iov_len) {
+      written -= iov[i].iov_len;
+      i++;
+    }
+    if (written > 0) {
+      iov[i].iov_base = (char*)iov[i].iov_base + written;
+      iov[i].iov_len -= written;
+    }
+  }
+  iov.clear();
+  return true;
+}
+}  // namespace
+
+BufferSaver::~BufferSaver() {
+  if (worker.joinable())
+    worker.join();
+}
+bool BufferSaver::save(const BufferSnapshot& lines,
+                       const LineOrigins& source,
+                       const std::string& filename,
+                       SaveDurability durability) {
+  size_t slash = filename.find_last_of('/');
+  std::string dirname = slash == std::string::npos ? "."
+                        : slash == 0               ? "/"
+                                                   : filename.substr(0, slash);
+  // a file in the same directory can be renamed over the target atomically
+  std::string tmpFilename = filename + ".ned.tmp";
+  int fd = open(tmpFilename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                0644);
+  if (fd < 0)
+    return fail("open " + tmpFilename, -1, "");
+  struct stat st {};
+  if (stat(filename.c_str(), &st) == 0 && fchmod(fd, st.st_mode & 07777) < 0)
+    return fail("chmod " + tmpFilename, fd, tmpFilename);
+  if (!writeLines(fd, lines, source))
+    return fail("write " + tmpFilename, fd, tmpFilename);
+  if (durability != SD_NONE && fdatasync(fd) < 0)
+    return fail("sync " + tmpFilename, fd, tmpFilename);
+  if (close(fd) < 0)
+    return fail("close " + tmpFilename, -1, tmpFilename);
+  if (rename(tmpFilename.c_str(), filename.c_str()) < 0)
+    return fail("rename " + tmpFilename, -1, tmpFilename);
+  if (durability == SD_FULL) {
+    // the rename only survives a crash once the directory is synced
+    int dirFd = open(dirname.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dirFd < 0 || fsync(dirFd) < 0)
+      return fail("sync " + dirname, dirFd, "");
+    close(dirFd);
+  }
+  error = "";
+  return true;
+}
+void BufferSaver::start(BufferSnapshot&& lines,
+                        size_t byteCount,
+                        const LineOrigins& source,
+                        const std::string& filename,
+                        SaveDurability durability) {
+  finish();
+  snapshot = std::move(lines);
+  snapshotSource = source;
+  totalBytes = byteCount;
+  bytesWritten = 0;
+  isWorkerDone = false;
+  worker = std::thread([this, filename, durability]() {
+    snapshot.fill();
+    isSuccess = save(snapshot, snapshotSource, filename, durability);
+    // rows only this snapshot still held are freed here rather than on the
+    // ui thread
+    snapshot = BufferSnapshot{};
+    std::vector<long long>().swap(snapshotSource.offsets);
+    isWorkerDone = true;
+  });
+}
+bool BufferSaver::isDone() const {
+  return isWorkerDone;
+}
+bool BufferSaver::finish() {
+  if (worker.joinable())
+    worker.join();
+  return isSuccess;
+}
+int BufferSaver::getProgress() const {
+  if (totalBytes == 0)
+    return 100;
+  return bytesWritten * 100 / totalBytes;
+}
+const std::string& BufferSaver::getError() const {
+  return error;
+}
+
+bool BufferSaver::fail(const std::string& what,
+                       int fd,
+                       const std::string& tmpFilename) {
+  error = what + ": " + strerror(errno);
+  if (fd >= 0)
+    close(fd);
+  if (tmpFilename.size() > 0)
+    unlink(tmpFilename.c_str());
+  return false;
+}
+bool BufferSaver::writeLines(int fd,
+                             const BufferSnapshot& lines,
+                             const LineOrigins& source) {
+  int sourceFd = -1;
+  struct stat st {};
+  if (source.filename.size() > 0)
+    sourceFd = open(source.filename.c_str(), O_RDONLY | O_CLOEXEC);
+  if (sourceFd >= 0 && (fstat(sourceFd, &st) < 0 || !source.isSource(st))) {
+    close(sourceFd);
+    sourceFd = -1;
+  }
+  // rows are gathered straight from the buffer, a batch per syscall
+  std::vector<iovec> iov{};
+  iov.reserve(IOV_MAX);
+  auto addSeparator = [&](size_t row) {
+    if (row < lines.size() - 1)
+      iov.push_back(iovec{NEWLINE, 1});
+    return iov.size() < IOV_MAX - 1 || writeAll(fd, iov, bytesWritten);
+  };
+  bool isWritten = true;
+  size_t row = 0;
+  while (isWritten && row < lines.size()) {
+    // rows [row, end) follow each other unchanged in the source file
+    size_t end = row + 1;
+    long long length = 0;
+    if (sourceFd >= 0 && source.offsets[row] >= 0) {
+      while (end < lines.size() &&
+             source.offsets[end] == source.offsets[end - 1] +
+                                        (long long)lines[end - 1].size() + 1)
+        end++;
+      length = source.offsets[end - 1] + lines[end - 1].size() -
+               source.offsets[row];
+    }
+    if (length >= MIN_COPIED_EXTENT &&
+        source.offsets[row] + length <= (long long)st.st_size) {
+      isWritten = writeAll(fd, iov, bytesWritten) &&
+                  copyExtent(sourceFd, fd, source.offsets[row], length) &&
+                  addSeparator(end - 1);
+      row = end;
+      continue;
+    }
+    for (; isWritten && row < end; row++) {
+      if (lines[row].size() > 0)
+        iov.push_back(iovec{(void*)lines[row].data(), lines[row].size()});
+      isWritten = addSeparator(row);
+    }
+  }
+  if (sourceFd >= 0)
+    close(sourceFd);
+  return isWritten && writeAll(fd, iov, bytesWritten);
+}
+bool BufferSaver::copyExtent(int sourceFd,
+                             int fd,
+                             long long offset,
+                             long long length) {
+  // the kernel shares the blocks where the filesystem can, or at least copies
+  // them without a round trip through userspace
+  loff_t sourceOffset = offset;
+  while (length > 0) {
+    ssize_t copied =
+        copy_file_range(sourceFd, &sourceOffset, fd, nullptr, length, 0);
+    if (copied < 0 && errno == EINTR)
+      continue;
+    if (copied <= 0)
+      break;
+    length -= copied;
+    bytesWritten += copied;
+  }
+  if (length == 0)
+    return true;
+  // not supported between these files, read and write what's left instead
+  std::unique_ptr<char[]> buffer{new char[COPY_BUFFER_SIZE]};
+  while (length > 0) {
+    ssize_t bytesRead =
+        pread(sourceFd, buffer.get(),
+              std::min((long long)COPY_BUFFER_SIZE, length), sourceOffset);
+    if (bytesRead < 0 && errno == EINTR)
+      continue;
+    if (bytesRead == 0)
+      errno = EIO;
+    if (bytesRead <= 0)
+      return false;
+    std::vector<iovec> iov{iovec{buffer.get(), (size_t)bytesRead}};
+    if (!writeAll(fd, iov, bytesWritten))
+      return false;
+    length -= bytesRead;
+    sourceOffset += bytesRead;
+  }
+  return true;
+}
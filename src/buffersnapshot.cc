@@ -0,0 +1,20 @@
+#include <algorithm>
+#include "pane.hh"
+
+size_t BufferSnapshot::getVersion() const {
+  return version;
+}
+size_t BufferSnapshot::size() const {
+  return starts.back();
+}
+void BufferSnapshot::fill() {
+  if (copies == nullptr)
+    return;
+  copies->finish(0, size());
+  copies = nullptr;
+}
+const std::string& BufferSnapshot::operator[](size_t row) const {
+  size_t chunk =
+      std::upper_bound(starts.begin(), starts.end(), row) - starts.begin() - 1;
+  return (*chunks[chunk])[row - starts[chunk]];
+}
@@ -0,0 +1,136 @@
+#include <algorithm>
+#include "pane.hh"
+
+namespace {
+constexpr size_t SNAPSHOT_CHUNK_ROWS = 4096;
+}  // namespace
+
+BufferVersions::~BufferVersions() {
+  // nothing may copy from the buffer once it's gone
+  finishCopies(0, std::string::npos);
+}
+BufferSnapshot BufferVersions::snapshot(const EditBuffer& buf) {
+  // chunks edited since the last snapshot, or freed with the last snapshot
+  // holding them, are copied again, split back down to the chunk size. the
+  // copying is left to the reader. chunks the last snapshot's reader hasn't
+  // copied yet are shared, so they're copied first
+  finishCopies(0, std::string::npos);
+  BufferSnapshot snapshot{};
+  snapshot.version = version;
+  std::vector<std::shared_ptr<SnapshotChunk>> held{};
+  std::vector<SnapshotCopies::Piece> pieces{};
+  std::vector<size_t> sizes{};
+  size_t row = 0;
+  for (size_t i = 0; i < chunks.size(); i++) {
+    size_t size = chunkSizes.get(i);
+    std::shared_ptr<SnapshotChunk> chunk = chunks[i].lock();
+    if (chunk != nullptr) {
+      held.push_back(std::move(chunk));
+      sizes.push_back(size);
+      row += size;
+      continue;
+    }
+    for (size_t r = row; r < row + size; r += SNAPSHOT_CHUNK_ROWS) {
+      size_t count = std::min(SNAPSHOT_CHUNK_ROWS, row + size - r);
+      held.push_back(std::make_shared<SnapshotChunk>());
+      pieces.push_back(SnapshotCopies::Piece{held.back(), r, count});
+      sizes.push_back(count);
+    }
+    row += size;
+  }
+  if (held.size() != chunks.size() || pieces.size() > 0) {
+    chunks.assign(held.begin(), held.end());
+    chunkSizes.assign(std::move(sizes));
+  }
+  for (const std::shared_ptr<SnapshotChunk>& chunk : held) {
+    snapshot.chunks.emplace_back(chunk, &chunk->rows);
+  }
+  if (pieces.size() > 0) {
+    snapshot.copies =
+        std::make_shared<SnapshotCopies>(buf.lines, std::move(pieces));
+    copies = snapshot.copies;
+  }
+  snapshot.starts.reserve(chunks.size() + 1);
+  for (size_t i = 0; i < chunks.size(); i++) {
+    snapshot.starts.push_back(snapshot.starts.back() + chunkSizes.get(i));
+  }
+  return snapshot;
+}
+size_t BufferVersions::getVersion() const {
+  return version;
+}
+size_t BufferVersions::getMemoryUsage() const {
+  long long usage = 0;
+  for (const std::weak_ptr<SnapshotChunk>& weakChunk : chunks) {
+    if (std::shared_ptr<SnapshotChunk> chunk = weakChunk.lock())
+      usage += chunk->bytes;
+  }
+  return usage;
+}
+void BufferVersions::bufferLoaded(const EditBuffer& buf, const std::string&) {
+  version++;
+  chunks.assign(1, {});
+  chunkSizes.assign({buf.lines.size()});
+}
+void BufferVersions::rowsWillMove(const EditBuffer&) {
+  finishCopies(0, std::string::npos);
+}
+void BufferVersions::linesWillChange(const EditBuffer&,
+                                     size_t row,
+                                     size_t count) {
+  // rows edited in place only need their own chunks copied first
+  finishCopies(row, row + count);
+}
+void BufferVersions::linesChanged(const EditBuffer&,
+                                  size_t row,
+                                  size_t removed,
+                                  size_t inserted) {
+  version++;
+  if (chunks.size() == 0) {
+    chunks.assign(1, {});
+    chunkSizes.assign({0});
+  }
+  // the chunks holding the replaced rows become one edited chunk. rows
+  // inserted after the last row go into the last chunk
+  size_t start = 0;
+  size_t first = findChunk(row, start);
+  if (first >= chunks.size()) {
+    first = chunks.size() - 1;
+    start -= chunkSizes.get(first);
+  }
+  size_t end = first + 1;
+  size_t endRow = start + chunkSizes.get(first);
+  while (endRow < row + removed) {
+    endRow += chunkSizes.get(end++);
+  }
+  chunks[first] = {};
+  if (end > first + 1) {
+    chunks.erase(chunks.begin() + first + 1, chunks.begin() + end);
+    chunkSizes.splice(first + 1, end - first - 1, 0);
+  }
+  chunkSizes.set(first, endRow - start - removed + inserted);
+}
+void BufferVersions::rowsReplaced(
+    const EditBuffer&,
+    const std::vector<std::vector<RowChange>>& shards) {
+  version++;
+  for (const std::vector<RowChange>& shard : shards) {
+    for (const RowChange& change : shard) {
+      size_t start = 0;
+      chunks[findChunk(change.row, start)] = {};
+    }
+  }
+}
+
+void BufferVersions::finishCopies(size_t first, size_t last) {
+  std::shared_ptr<SnapshotCopies> pending = copies.lock();
+  if (pending != nullptr)
+    pending->finish(first, last);
+}
+size_t BufferVersions::findChunk(size_t row, size_t& start) const {
+  // empty chunks are skipped over, onto the chunk holding the row
+  size_t offset = row;
+  size_t chunk = chunkSizes.find(offset);
+  start = row - offset;
+  return chunk;
+}
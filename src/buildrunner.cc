@@ -0,0 +1,194 @@
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <iostream>
+#include "pane.hh"
+
+namespace {
+// output is read in pieces this size, so a chatty build can't stall a tick
+constexpr size_t MAX_READ_PER_POLL = 1 << 20;
+
+std::string getRealPath(const std::string& path) {
+  char* resolved = realpath(path.c_str(), nullptr);
+  if (resolved == nullptr)
+    return path;
+  std::string realPath{resolved};
+  free(resolved);
+  return realPath;
+}
+bool readNumber(const std::string& line, size_t& i, size_t& n) {
+  size_t start = i;
+  n = 0;
+  while (i < line.size() && line[i] >= '0' && line[i] <= '9') {
+    n = n * 10 + (line[i] - '0');
+    i++;
+  }
+  return i > start;
+}
+}  // namespace
+
+BuildRunner::~BuildRunner() {
+  stop();
+}
+bool BuildRunner::start(const std::string& command) {
+  stop();
+  int fds[2];
+  if (pipe2(fds, O_CLOEXEC) < 0) {
+    std::cout << "ERROR:BuildRunner::start pipe failed" << std::endl;
+    return false;
+  }
+  pid = fork();
+  if (pid < 0) {
+    std::cout << "ERROR:BuildRunner::start fork failed" << std::endl;
+    close(fds[0]);
+    close(fds[1]);
+    return false;
+  }
+  if (pid == 0) {
+    // in a group of its own, so stopping reaches whatever it starts
+    setpgid(0, 0);
+    signal(SIGPIPE, SIG_DFL);
+    int null = open("/dev/null", O_RDONLY);
+    dup2(null, STDIN_FILENO);
+    dup2(fds[1], STDOUT_FILENO);
+    dup2(fds[1], STDERR_FILENO);
+    execl("/bin/sh", "sh", "-c", command.c_str(), (char*)nullptr);
+    _exit(127);
+  }
+  setpgid(pid, pid);
+  close(fds[1]);
+  outputFd = fds[0];
+  fcntl(outputFd, F_SETFL, O_NONBLOCK);
+  this->command = command;
+  pendingOutput.clear();
+  directories.clear();
+  diagnostics.clear();
+  counts[DS_WARNING] = 0;
+  counts[DS_ERROR] = 0;
+  return true;
+}
+void BuildRunner::stop() {
+  if (outputFd >= 0) {
+    close(outputFd);
+    outputFd = -1;
+  }
+  if (pid > 0) {
+    kill(-pid, SIGKILL);
+    waitpid(pid, &exitStatus, 0);
+    pid = -1;
+  }
+}
+bool BuildRunner::isRunning() const {
+  return pid > 0;
+}
+bool BuildRunner::poll() {
+  if (outputFd < 0)
+    return false;
+  bool isChanged = false;
+  char chunk[65536];
+  size_t total = 0;
+  while (total < MAX_READ_PER_POLL) {
+    ssize_t size = read(outputFd, chunk, sizeof(chunk));
+    if (size < 0)
+      return isChanged;
+    if (size == 0)
+      break;
+    total += size;
+    pendingOutput.append(chunk, size);
+    // diagnostics show up a line at a time, as soon as they're complete
+    size_t start = 0;
+    size_t newline = 0;
+    while ((newline = pendingOutput.find('\n', start)) != std::string::npos) {
+      parseLine(pendingOutput.substr(start, newline - start));
+      start = newline + 1;
+    }
+    pendingOutput.erase(0, start);
+    isChanged = true;
+  }
+  if (total >= MAX_READ_PER_POLL)
+    return isChanged;
+  // the build and everything it started closed their output
+  if (pendingOutput.size() > 0)
+    parseLine(pendingOutput);
+  pendingOutput.clear();
+  close(outputFd);
+  outputFd = -1;
+  waitpid(pid, &exitStatus, 0);
+  pid = -1;
+  return true;
+}
+std::string BuildRunner::getStatus() const {
+  if (command.size() == 0)
+    return "";
+  std::string status{};
+  if (isRunning())
+    status = "building";
+  else if (WIFEXITED(exitStatus) && WEXITSTATUS(exitStatus) == 0)
+    status = "build ok";
+  else
+    status = "build failed";
+  if (counts[DS_ERROR] > 0)
+    status.append(" " + std::to_string(counts[DS_ERROR]) + " errors");
+  if (counts[DS_WARNING] > 0)
+    status.append(" " + std::to_string(counts[DS_WARNING]) + " warnings");
+  return status;
+}
+const std::map<size_t, Diagnostic>* BuildRunner::getDiagnostics(
+    const std::string& filename) const {
+  if (diagnostics.size() == 0)
+    return nullptr;
+  auto file = diagnostics.find(getRealPath(filename));
+  return file != diagnostics.end() ? &file->second : nullptr;
+}
+
+void BuildRunner::parseLine(const std::string& line) {
+  // make: Entering directory '/path'
+  const std::string entering{"Entering directory '"};
+  size_t found = line.find(entering);
+  if (found != std::string::npos && line.back() == '\'') {
+    size_t start = found + entering.size();
+    directories.push_back(line.substr(start, line.size() - start - 1));
+    return;
+  }
+  if (line.find("Leaving directory '") != std::string::npos) {
+    if (directories.size() > 0)
+      directories.pop_back();
+    return;
+  }
+  // path:line:col: severity: message, the column being optional
+  for (size_t colon = line.find(':'); colon != std::string::npos;
+       colon = line.find(':', colon + 1)) {
+    size_t i = colon + 1;
+    size_t row{}, col{};
+    if (!readNumber(line, i, row) || i >= line.size() || line[i] != ':')
+      continue;
+    i++;
+    if (readNumber(line, i, col)) {
+      if (i >= line.size() || line[i] != ':')
+        continue;
+      i++;
+    }
+    while (i < line.size() && line[i] == ' ')
+      i++;
+    Diagnostic diagnostic{col > 0 ? col - 1 : 0, DS_ERROR, line.substr(i)};
+    if (line.compare(i, 7, "warning") == 0)
+      diagnostic.severity = DS_WARNING;
+    else if (line.compare(i, 5, "error") != 0 &&
+             line.compare(i, 11, "fatal error") != 0)
+      return;
+    std::string path = line.substr(0, colon);
+    if (path.size() > 0 && path[0] != '/' && directories.size() > 0)
+      path = directories.back() + "/" + path;
+    counts[diagnostic.severity]++;
+    std::map<size_t, Diagnostic>& rows = diagnostics[getRealPath(path)];
+    size_t index = row > 0 ? row - 1 : 0;
+    // a row keeps its first error over any warnings
+    auto existing = rows.find(index);
+    if (existing == rows.end() ||
+        existing->second.severity < diagnostic.severity)
+      rows[index] = std::move(diagnostic);
+    return;
+  }
+}
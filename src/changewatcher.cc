@@ -0,0 +1,43 @@
+#include <sys/inotify.h>
+#include <unistd.h>
+#include "pane.hh"
+
+ChangeWatcher::ChangeWatcher() {
+  inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+}
+ChangeWatcher::~ChangeWatcher() {
+  if (inotifyFd >= 0)
+    close(inotifyFd);
+}
+void ChangeWatcher::watch(const std::string& filename) {
+  if (inotifyFd < 0 || filename.size() == 0)
+    return;
+  std::string path = getPath(filename);
+  std::string directory = path.substr(0, path.find_last_of('/'));
+  // watching a directory twice returns the same descriptor
+  int wd = inotify_add_watch(inotifyFd, directory.c_str(),
+                             IN_CLOSE_WRITE | IN_MOVED_TO);
+  if (wd >= 0)
+    directories[wd] = directory;
+}
+std::vector<std::string> ChangeWatcher::poll() {
+  std::vector<std::string> paths{};
+  alignas(inotify_event) char events[4096];
+  ssize_t size{};
+  while (inotifyFd >= 0 &&
+         (size = read(inotifyFd, events, sizeof(events))) > 0) {
+    for (char* p = events; p < events + size;) {
+      auto event = (inotify_event*)p;
+      auto directory = directories.find(event->wd);
+      if (event->len > 0 && directory != directories.end())
+        paths.push_back(directory->second + "/" + event->name);
+      p += sizeof(inotify_event) + event->len;
+    }
+  }
+  return paths;
+}
+std::string ChangeWatcher::getPath(const std::string& filename) {
+  if (filename.find('/') == std::string::npos)
+    return "./" + filename;
+  return filename;
+}
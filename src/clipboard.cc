@@ -0,0 +1,56 @@
+#include <algorithm>
+#include "pane.hh"
+
+void Clipboard::copy(const EditBuffer& buf,
+                     const std::vector<BufferCursor>& cursors) {
+  // each selection is copied once, into the slice every paste of it shares
+  slices.clear();
+  joined = nullptr;
+  for (const BufferCursor& cursor : cursors) {
+    BufferPosition start =
+        std::min(cursor.getPosition(), cursor.getTailPosition());
+    BufferPosition end =
+        std::max(cursor.getPosition(), cursor.getTailPosition());
+    auto rows = new std::vector<std::string>(1);
+    if (start != end)
+      appendSelection(buf, start, end, *rows);
+    slices.push_back(makeLineSlice(rows));
+  }
+}
+bool Clipboard::isEmpty() const {
+  return slices.size() == 0;
+}
+std::vector<LineSlice> Clipboard::getSlices(size_t cursorCount) {
+  if (slices.size() == cursorCount)
+    return slices;
+  // paste everything at every cursor
+  if (joined == nullptr) {
+    auto rows = new std::vector<std::string>(1);
+    for (size_t i = 0; i < slices.size(); i++) {
+      if (i > 0)
+        rows->push_back("");
+      rows->back().append(slices[i]->front());
+      rows->insert(rows->end(), slices[i]->begin() + 1, slices[i]->end());
+    }
+    joined = makeLineSlice(rows);
+  }
+  return std::vector<LineSlice>(cursorCount, joined);
+}
+
+void Clipboard::appendSelection(const EditBuffer& buf,
+                                BufferPosition start,
+                                BufferPosition end,
+                                std::vector<std::string>& rows) {
+  // the selection continues the last row
+  rows.reserve(rows.size() + end.row - start.row);
+  for (size_t row = start.row; row <= end.row; row++) {
+    const std::string& line = buf.lines[row];
+    size_t rowStart = row == start.row ? start.col : 0;
+    size_t rowEnd = row == end.row ? end.col : line.size();
+    rowStart = std::min(rowStart, line.size());
+    rowEnd = std::max(rowStart, std::min(rowEnd, line.size()));
+    if (row > start.row)
+      rows.emplace_back();
+    rows.back().append(line, rowStart, rowEnd - rowStart);
+  }
+}
@@ -1,10 +1,19 @@
 #pragma once
+#define CTRL_B 2
 #define CTRL_C 3
 #define CTRL_D 4
 #define CTRL_F 6
+#define CTRL_G 7
+#define CTRL_K 11
+#define CTRL_N 14
 #define CTRL_O 15
+#define CTRL_P 16
 #define CTRL_Q 17
+#define CTRL_R 18
 #define CTRL_S 19
+#define CTRL_T 20
+#define CTRL_V 22
+#define CTRL_W 23
 #define CTRL_Z 26
 #define CTRL_Y 25
 
@@ -20,6 +29,8 @@
 #define CTRL_DOWN 525
 #define CTRL_LEFT 545
 #define CTRL_RIGHT 560
+#define CTRL_PAGE_UP 555
+#define CTRL_PAGE_DOWN 550
 
 #define PAGE_UP 339
 #define PAGE_DOWN 338
@@ -35,7 +46,9 @@
 #define ESCAPE 27
 #define BACKSPACE 263
 #define DELETE 330
+#define RESIZE 410
 
 #define TABSTOPWIDTH 4
+#define MEMORY_BUDGET (512UL * 1024 * 1024)
 
 void exitNed(int signum);
@@ -1,15 +1,170 @@
+#include <string.h>
+#include <algorithm>
 #include <fstream>
 #include <iostream>
+#include <numeric>
 #include "const.hh"
 #include "pane.hh"
 
+LineSlice makeLineSlice(std::vector<std::string>* rows) {
+  for (const std::string& row : *rows) {
+    MemoryStats::addString(MS_CLIPBOARD, row, 1);
+  }
+  long long arrayBytes = rows->capacity() * sizeof(std::string);
+  MemoryStats::add(MS_CLIPBOARD, arrayBytes, 1);
+  return LineSlice(rows, [arrayBytes](const std::vector<std::string>* rows) {
+    for (const std::string& row : *rows) {
+      MemoryStats::addString(MS_CLIPBOARD, row, -1);
+    }
+    MemoryStats::add(MS_CLIPBOARD, -arrayBytes, -1);
+    delete rows;
+  });
+}
+
+namespace {
+// replace all works a shard of rows at a time, several shards per thread so a
+// few long rows don't hold the rest up
+constexpr size_t REPLACE_SHARD_ROWS = 16384;
+
+void putIndex(std::string& out, size_t index) {
+  out.append((const char*)&index, sizeof(index));
+}
+size_t getIndex(const std::string& in, size_t& i) {
+  size_t index{};
+  memcpy(&index, in.data() + i, sizeof(index));
+  i += sizeof(index);
+  return index;
+}
+
+// a row being sorted, and 16 bytes of it from the depth it's being sorted
+// at, so most comparisons don't have to reach into the row
+struct SortCache {
+  uint64_t high{}, low{};
+};
+bool operator<(const SortCache& a, const SortCache& b) {
+  return a.high < b.high || (a.high == b.high && a.low < b.low);
+}
+struct SortKey {
+  SortCache cache{};
+  size_t row{};
+};
+constexpr size_t SORT_CACHE_BYTES = 2 * sizeof(uint64_t);
+constexpr size_t SORT_SMALL_ROWS = 32;
+// past this much shared prefix the rest of the rows are compared whole
+// rather than a few bytes at a time
+constexpr size_t SORT_MAX_DEPTH = 256;
+
+SortCache loadSortCache(const std::string& line, size_t depth) {
+  SortCache cache{};
+  for (size_t i = depth; i < depth + SORT_CACHE_BYTES; i++) {
+    cache.high = cache.high << 8 | cache.low >> 56;
+    cache.low = cache.low << 8 | (i < line.size() ? (unsigned char)line[i] : 0);
+  }
+  return cache;
+}
+
+// keys are sorted on their cached bytes, then every run of keys equal on them
+// is sorted on the next bytes. rows sort by position once they're equal. runs
+// wait on a stack rather than in recursion, which a long shared prefix would
+// take deep
+void sortKeys(const std::string* rows, SortKey* keys, size_t n) {
+  struct Run {
+    SortKey* keys{};
+    size_t n{};
+    // the rows are equal up to here
+    size_t depth{};
+  };
+  std::vector<Run> runs{Run{keys, n, 0}};
+  while (runs.size() > 0) {
+    Run run = runs.back();
+    runs.pop_back();
+    auto less = [rows, &run](const SortKey& a, const SortKey& b) {
+      int order = rows[a.row].compare(run.depth, std::string::npos,
+                                      rows[b.row], run.depth,
+                                      std::string::npos);
+      return order < 0 || (order == 0 && a.row < b.row);
+    };
+    SortKey* end = run.keys + run.n;
+    if (run.n <= SORT_SMALL_ROWS || run.depth >= SORT_MAX_DEPTH) {
+      std::sort(run.keys, end, less);
+      continue;
+    }
+    std::sort(run.keys, end, [](const SortKey& a, const SortKey& b) {
+      return a.cache < b.cache;
+    });
+    size_t nextDepth = run.depth + SORT_CACHE_BYTES;
+    for (SortKey *first = run.keys, *last = first + 1; first < end;
+         first = last++) {
+      while (last < end && !(first->cache < last->cache))
+        last++;
+      if (last - first == 1)
+        continue;
+      // rows ending within the cached bytes are prefixes of the rest, and
+      // equal to each other but for trailing zero bytes
+      SortKey* ongoing =
+          std::partition(first, last, [rows, nextDepth](const SortKey& key) {
+            return rows[key.row].size() <= nextDepth;
+          });
+      std::sort(first, ongoing, less);
+      for (SortKey* key = ongoing; key < last; key++) {
+        key->cache = loadSortCache(rows[key->row], nextDepth);
+      }
+      runs.push_back(Run{ongoing, (size_t)(last - ongoing), nextDepth});
+    }
+  }
+}
+
+// sorts the offsets of rows from first, equal rows by position. shards are
+// sorted in parallel, then pairs of sorted runs are merged in parallel, a
+// round at a time
+void sortRows(const std::vector<std::string>& lines,
+              size_t first,
+              std::vector<size_t>& order) {
+  const std::string* rows = lines.data() + first;
+  size_t shardCount = std::max(1u, std::thread::hardware_concurrency());
+  std::vector<size_t> bounds(shardCount + 1);
+  for (size_t i = 0; i <= shardCount; i++) {
+    bounds[i] = order.size() * i / shardCount;
+  }
+  forEachShard(shardCount, [rows, &order, &bounds](size_t shard) {
+    std::vector<SortKey> keys{};
+    keys.reserve(bounds[shard + 1] - bounds[shard]);
+    for (size_t i = bounds[shard]; i < bounds[shard + 1]; i++) {
+      keys.push_back(SortKey{loadSortCache(rows[order[i]], 0), order[i]});
+    }
+    sortKeys(rows, keys.data(), keys.size());
+    for (size_t i = 0; i < keys.size(); i++) {
+      order[bounds[shard] + i] = keys[i].row;
+    }
+  });
+  auto less = [rows](size_t a, size_t b) {
+    int order = rows[a].compare(rows[b]);
+    return order < 0 || (order == 0 && a < b);
+  };
+  std::vector<size_t> merged(shardCount > 1 ? order.size() : 0);
+  for (size_t width = 1; width < shardCount; width *= 2) {
+    size_t pairCount = (shardCount + 2 * width - 1) / (2 * width);
+    forEachShard(pairCount, [&, width](size_t pair) {
+      size_t low = bounds[std::min(2 * pair * width, shardCount)];
+      size_t middle = bounds[std::min((2 * pair + 1) * width, shardCount)];
+      size_t high = bounds[std::min((2 * pair + 2) * width, shardCount)];
+      std::merge(order.begin() + low, order.begin() + middle,
+                 order.begin() + middle, order.begin() + high,
+                 merged.begin() + low, less);
+    });
+    order.swap(merged);
+  }
+}
+}  // namespace
+
 BufferOperation EditBuffer::insertAtCursors(std::vector<BufferCursor>& cursors,
                                             int keycode) {
   if (lines.size() == 0) {
+    notifyLinesWillChange(0, 0);
     lines.push_back("");
+    notifyLinesChanged(0, 0, 1);
   }
   std::string insertText{""};
-  std::vector<std::string> insertTexts{};
   BufOpType bot = BO_INSERT;
   switch (keycode) {
     case BACKSPACE:
@@ -34,10 +189,67 @@ BufferOperation EditBuffer::insertAtCursors(std::vector<BufferCursor>& cursors,
       insertText.append(1, keycode);
       break;
   }
-  insertTexts.insert(insertTexts.begin(), cursors.size(), insertText);
-  BufferOperation bufOp{bot, cursors, insertTexts};
+  BufferOperation bufOp{bot, cursors, {}, &opResource};
+  bufOp.insertTexts.push_back(std::move(insertText));
   doBufferOperation(bufOp);
-  cursors = bufOp.oCursors;
+  cursors.assign(bufOp.oCursors.begin(), bufOp.oCursors.end());
+  return bufOp;
+}
+BufferOperation EditBuffer::insertTextAtCursors(
+    std::vector<BufferCursor>& cursors,
+    const std::string& text) {
+  if (lines.size() == 0) {
+    notifyLinesWillChange(0, 0);
+    lines.push_back("");
+    notifyLinesChanged(0, 0, 1);
+  }
+  BufferOperation bufOp{BO_INSERT, cursors, {}, &opResource};
+  bufOp.insertTexts.push_back(text);
+  doBufferOperation(bufOp);
+  cursors.assign(bufOp.oCursors.begin(), bufOp.oCursors.end());
+  return bufOp;
+}
+BufferOperation EditBuffer::pasteAtCursors(
+    std::vector<BufferCursor>& cursors,
+    const std::vector<LineSlice>& slices) {
+  if (lines.size() == 0) {
+    notifyLinesWillChange(0, 0);
+    lines.push_back("");
+    notifyLinesChanged(0, 0, 1);
+  }
+  BufferOperation bufOp{BO_PASTE, cursors, {}, &opResource};
+  bufOp.insertSlices = slices;
+  doBufferOperation(bufOp);
+  cursors.assign(bufOp.oCursors.begin(), bufOp.oCursors.end());
+  return bufOp;
+}
+BufferOperation EditBuffer::replaceAll(std::vector<BufferCursor>& cursors,
+                                       const std::string& query,
+                                       const std::string& replacement,
+                                       size_t& count) {
+  BufferOperation bufOp{BO_REPLACE, cursors, {}, &opResource};
+  bufOp.insertTexts.push_back(query);
+  bufOp.insertTexts.push_back(replacement);
+  count = replaceRows(bufOp);
+  cursors.assign(bufOp.oCursors.begin(), bufOp.oCursors.end());
+  return bufOp;
+}
+BufferOperation EditBuffer::reorderRows(std::vector<BufferCursor>& cursors,
+                                        const std::string& kind,
+                                        size_t& count) {
+  BufferOperation bufOp{BO_REORDER, cursors, {}, &opResource};
+  bufOp.insertTexts.push_back(kind);
+  count = applyReorder(bufOp);
+  cursors.assign(bufOp.oCursors.begin(), bufOp.oCursors.end());
+  return bufOp;
+}
+BufferOperation EditBuffer::filterRows(std::vector<BufferCursor>& cursors,
+                                       std::vector<std::string>&& rows) {
+  BufferOperation bufOp{BO_FILTER, cursors, {}, &opResource};
+  bufOp.insertSlices.push_back(
+      makeLineSlice(new std::vector<std::string>(std::move(rows))));
+  applyFilter(bufOp);
+  cursors.assign(bufOp.oCursors.begin(), bufOp.oCursors.end());
   return bufOp;
 }
 void EditBuffer::undoBufferOperation(const BufferOperation& bufOp) {
@@ -57,6 +269,18 @@ void EditBuffer::undoBufferOperation(const BufferOperation& bufOp) {
     case BO_SLIDE_DOWN:
       undoSlideDown(bufOp);
       break;
+    case BO_PASTE:
+      undoPaste(bufOp);
+      break;
+    case BO_REPLACE:
+      undoReplace(bufOp);
+      break;
+    case BO_REORDER:
+      undoReorder(bufOp);
+      break;
+    case BO_FILTER:
+      undoFilter(bufOp);
+      break;
   }
 }
 
@@ -82,16 +306,37 @@ BufferCursor EditBuffer::selectPrecedingText(const std::string& text,
   return endCursor;
 }
 
+BufferCursor EditBuffer::selectPrecedingLines(
+    const std::vector<std::string>& slice,
+    BufferCursor endCursor) {
+  size_t sRow = endCursor.getRow() - (slice.size() - 1);
+  size_t sCol{};
+  if (slice.size() == 1) {
+    sCol = endCursor.getCol() - slice[0].size();
+  } else {
+    sCol = lines[sRow].size() - slice[0].size();
+  }
+  endCursor.selectSet(sCol, sRow);
+  return endCursor;
+}
 void EditBuffer::undoInsertText(const BufferOperation& bufOp) {
-  for (size_t i = 0; i < bufOp.insertTexts.size(); i++) {
+  for (size_t i = 0; i < bufOp.oCursors.size(); i++) {
     BufferCursor insertCursor =
-        selectPrecedingText(bufOp.insertTexts[i], bufOp.oCursors[i]);
+        selectPrecedingText(bufOp.getInsertText(i), bufOp.oCursors[i]);
     // remove the inserted text
     clearSelection(insertCursor);
     // add the removed text
     insertTextAtCursor(insertCursor, bufOp.removedTexts[i]);
   }
 }
+void EditBuffer::undoPaste(const BufferOperation& bufOp) {
+  for (size_t i = bufOp.insertSlices.size(); i-- > 0;) {
+    BufferCursor insertCursor =
+        selectPrecedingLines(*bufOp.insertSlices[i], bufOp.oCursors[i]);
+    clearSelection(insertCursor);
+    insertTextAtCursor(insertCursor, bufOp.removedTexts[i]);
+  }
+}
 void EditBuffer::undoClearSelection(const BufferOperation& bufOp) {
   for (size_t i = 0; i < bufOp.removedTexts.size(); i++) {
     BufferCursor insertCursor = bufOp.oCursors[i];
@@ -99,19 +344,25 @@ void EditBuffer::undoClearSelection(const BufferOperation& bufOp) {
   }
 }
 void EditBuffer::undoSlideUp(const BufferOperation& bufOp) {
-  BufferOperation uBufOp{BO_SLIDE_DOWN, bufOp.oCursors, {}};
+  std::vector<BufferCursor> cursors{bufOp.oCursors.begin(),
+                                    bufOp.oCursors.end()};
+  BufferOperation uBufOp{BO_SLIDE_DOWN, cursors, {}, &opResource};
   doBufferOperation(uBufOp);
 }
 void EditBuffer::undoSlideDown(const BufferOperation& bufOp) {
-  BufferOperation uBufOp{BO_SLIDE_UP, bufOp.oCursors, {}};
+  std::vector<BufferCursor> cursors{bufOp.oCursors.begin(),
+                                    bufOp.oCursors.end()};
+  BufferOperation uBufOp{BO_SLIDE_UP, cursors, {}, &opResource};
   doBufferOperation(uBufOp);
 }
-void EditBuffer::loadFromFile(const std::string& filename) {
+bool EditBuffer::loadFromFile(const std::string& filename) {
   std::ifstream ifile{filename.c_str()};
   if (!ifile.is_open()) {
     std::cout << "ERROR:loadFile Failed to open: " << filename << std::endl;
-    exitNed(1);
+    return false;
   }
+  notifyRowsWillMove();
+  accountLines(0, lines.size(), -1);
   lines.clear();
   std::string line{};
   while (std::getline(ifile, line)) {
@@ -119,15 +370,121 @@ void EditBuffer::loadFromFile(const std::string& filename) {
     line = "";
   }
   ifile.close();
+  accountLines(0, lines.size(), 1);
+  accountCapacity();
+  for (BufferObserver* observer : observers) {
+    observer->bufferLoaded(*this, filename);
+  }
+  return true;
+}
+EditBuffer::~EditBuffer() {
+  accountLines(0, lines.size(), -1);
+  MemoryStats::add(MS_LINES, -(long long)accountedCapacity,
+                   accountedCapacity > 0 ? -1 : 0);
+}
+void EditBuffer::unload() {
+  size_t oldSize = lines.size();
+  notifyLinesWillChange(0, oldSize);
+  std::vector<std::string>().swap(lines);
+  notifyLinesChanged(0, oldSize, 0);
+}
+BufferOperation EditBuffer::spliceRows(const std::vector<RowSplice>& splices) {
+  if (lines.size() == 0) {
+    // an empty buffer has no rows to select, so its rows are replaced as a
+    // whole, which undoing takes back to no rows at all
+    std::vector<std::string> rows{};
+    for (const RowSplice& splice : splices) {
+      rows.insert(rows.end(), splice.rows.begin(), splice.rows.end());
+    }
+    std::vector<BufferCursor> cursors{BufferCursor{}};
+    return filterRows(cursors, std::move(rows));
+  }
+  // each splice becomes a selection pasted over, bottom-up so the rows of the
+  // splices above are still where the diff found them
+  BufferOperation bufOp{BO_PASTE, {}, {}, &opResource};
+  for (size_t i = splices.size(); i-- > 0;) {
+    const RowSplice& splice = splices[i];
+    size_t removed = splice.removed;
+    auto rows = new std::vector<std::string>();
+    BufferCursor cursor{};
+    if (splice.row + removed < lines.size()) {
+      // whole rows, up to the start of the first kept row
+      rows->assign(splice.rows.begin(), splice.rows.end());
+      rows->push_back("");
+      cursor.moveSet(0, splice.row);
+      cursor.selectSet(0, splice.row + removed);
+    } else if (splice.row > 0) {
+      // the last rows, from the end of the row above them
+      size_t last = lines.size() - 1;
+      rows->push_back("");
+      rows->insert(rows->end(), splice.rows.begin(), splice.rows.end());
+      cursor.moveSet(lines[splice.row - 1].size(), splice.row - 1);
+      cursor.selectSet(lines[last].size(), last);
+    } else {
+      // every row
+      size_t last = lines.size() - 1;
+      rows->assign(splice.rows.begin(), splice.rows.end());
+      if (rows->size() == 0)
+        rows->push_back("");
+      cursor.moveSet(0, 0);
+      cursor.selectSet(lines[last].size(), last);
+    }
+    bufOp.iCursors.push_back(cursor);
+    bufOp.insertSlices.push_back(makeLineSlice(rows));
+    BufferOperation spliceOp{BO_PASTE, {}, {}, &opResource};
+    spliceOp.iCursors.push_back(cursor);
+    spliceOp.insertSlices.push_back(bufOp.insertSlices.back());
+    doBufferOperation(spliceOp);
+    bufOp.oCursors.push_back(spliceOp.oCursors[0]);
+    bufOp.removedTexts.push_back(std::move(spliceOp.removedTexts[0]));
+  }
+  return bufOp;
+}
+void EditBuffer::appendText(const char* text,
+                            size_t size,
+                            bool continuesLastRow) {
+  bool isRowOpen = continuesLastRow && lines.size() > 0;
+  size_t row = isRowOpen ? lines.size() - 1 : lines.size();
+  size_t removed = lines.size() - row;
+  notifyLinesWillChange(row, removed);
+  const char* end = text + size;
+  while (text < end) {
+    auto newline = (const char*)memchr(text, '\n', end - text);
+    const char* rowEnd = newline != nullptr ? newline : end;
+    if (!isRowOpen)
+      lines.emplace_back();
+    lines.back().append(text, rowEnd - text);
+    // like loadFromFile, a trailing newline doesn't start an empty row
+    isRowOpen = newline == nullptr;
+    text = newline != nullptr ? newline + 1 : end;
+  }
+  notifyLinesChanged(row, removed, lines.size() - row);
+}
+size_t EditBuffer::getMemoryUsage() const {
+  return accountedCapacity + accountedBytes;
 }
 void EditBuffer::doBufferOperation(BufferOperation& bufOp) {
+  if (bufOp.opType == BO_REPLACE) {
+    replaceRows(bufOp);
+    return;
+  }
+  if (bufOp.opType == BO_REORDER) {
+    applyReorder(bufOp);
+    return;
+  }
+  if (bufOp.opType == BO_FILTER) {
+    applyFilter(bufOp);
+    return;
+  }
+  bufOp.oCursors.reserve(bufOp.iCursors.size());
+  bufOp.removedTexts.reserve(bufOp.iCursors.size());
   for (size_t i = 0; i < bufOp.iCursors.size(); i++) {
     BufferCursor cursor = bufOp.iCursors[i];
     std::string removedText{""};
     switch (bufOp.opType) {
       case BO_INSERT:
         removedText = clearSelection(cursor);
-        insertTextAtCursor(cursor, bufOp.insertTexts[i]);
+        insertTextAtCursor(cursor, bufOp.getInsertText(i));
         break;
       case BO_BACKSPACE:
         removedText = clearSelection(cursor);
@@ -145,9 +502,320 @@ void EditBuffer::doBufferOperation(BufferOperation& bufOp) {
       case BO_SLIDE_DOWN:
         slideDownAtCursor(cursor);
         break;
+      case BO_PASTE:
+        removedText = clearSelection(cursor);
+        insertLinesAtCursor(cursor, *bufOp.insertSlices[i]);
+        break;
+      case BO_REPLACE:
+      case BO_REORDER:
+      case BO_FILTER:
+        // done for every row at once above
+        break;
     }
     bufOp.oCursors.push_back(cursor);
-    bufOp.removedTexts.push_back(removedText);
+    bufOp.removedTexts.push_back(std::move(removedText));
+  }
+}
+size_t EditBuffer::replaceRows(BufferOperation& bufOp) {
+  const std::string& query = bufOp.insertTexts[0];
+  const std::string& replacement = bufOp.insertTexts[1];
+  size_t shardCount = (lines.size() + REPLACE_SHARD_ROWS - 1) /
+                      REPLACE_SHARD_ROWS;
+  std::vector<std::vector<RowChange>> rows(shardCount);
+  // per shard: each changed row, its match count and the columns the
+  // replacements start at in the new row
+  std::vector<std::string> records(shardCount);
+  std::vector<size_t> counts(shardCount);
+  if (query.size() > 0) {
+    forEachShard(shardCount, [&](size_t shard) {
+      std::vector<size_t> columns{};
+      size_t end = std::min(lines.size(), (shard + 1) * REPLACE_SHARD_ROWS);
+      for (size_t row = shard * REPLACE_SHARD_ROWS; row < end; row++) {
+        const std::string& line = lines[row];
+        size_t match = line.find(query);
+        if (match == std::string::npos)
+          continue;
+        std::string replaced{};
+        size_t start = 0;
+        columns.clear();
+        while (match != std::string::npos) {
+          replaced.append(line, start, match - start);
+          columns.push_back(replaced.size());
+          replaced.append(replacement);
+          start = match + query.size();
+          match = line.find(query, start);
+        }
+        replaced.append(line, start, std::string::npos);
+        putIndex(records[shard], row);
+        putIndex(records[shard], columns.size());
+        for (size_t column : columns) {
+          putIndex(records[shard], column);
+        }
+        counts[shard] += columns.size();
+        rows[shard].push_back(RowChange{row, std::move(replaced)});
+      }
+    });
+  }
+  setRows(rows);
+  bufOp.removedTexts.assign(std::make_move_iterator(records.begin()),
+                            std::make_move_iterator(records.end()));
+  bufOp.oCursors.clear();
+  for (BufferCursor cursor : bufOp.iCursors) {
+    // replaced rows may have gotten shorter
+    if (cursor.getRow() < lines.size())
+      cursor.moveSet(std::min(cursor.getCol(), lines[cursor.getRow()].size()),
+                     cursor.getRow());
+    bufOp.oCursors.push_back(cursor);
+  }
+  size_t count = 0;
+  for (size_t shardMatches : counts) {
+    count += shardMatches;
+  }
+  return count;
+}
+void EditBuffer::undoReplace(const BufferOperation& bufOp) {
+  const std::string& query = bufOp.insertTexts[0];
+  const std::string& replacement = bufOp.insertTexts[1];
+  const auto& records = bufOp.removedTexts;
+  std::vector<std::vector<RowChange>> rows(records.size());
+  forEachShard(records.size(), [&](size_t shard) {
+    const std::string& record = records[shard];
+    size_t i = 0;
+    while (i < record.size()) {
+      size_t row = getIndex(record, i);
+      size_t count = getIndex(record, i);
+      const std::string& line = lines[row];
+      std::string restored{};
+      size_t start = 0;
+      for (size_t c = 0; c < count; c++) {
+        size_t column = getIndex(record, i);
+        restored.append(line, start, column - start);
+        restored.append(query);
+        start = column + replacement.size();
+      }
+      restored.append(line, start, std::string::npos);
+      rows[shard].push_back(RowChange{row, std::move(restored)});
+    }
+  });
+  setRows(rows);
+}
+size_t EditBuffer::applyReorder(BufferOperation& bufOp) {
+  const std::string& kind = bufOp.insertTexts[0];
+  size_t first = 0;
+  size_t count = 0;
+  getSelectedRows({bufOp.iCursors.begin(), bufOp.iCursors.end()}, first,
+                  count);
+  // rows are reordered by reference, as offsets from first. targets holds
+  // the row each of them goes to, which is all undo needs
+  std::vector<size_t> order(count);
+  std::iota(order.begin(), order.end(), 0);
+  std::vector<size_t> targets(count);
+  if (kind == "reverse") {
+    std::reverse(order.begin(), order.end());
+  } else {
+    sortRows(lines, first, order);
+  }
+  if (kind == "unique") {
+    // equal rows sort by position, so each run starts with the row that's
+    // kept. the rows kept stay in their order
+    std::vector<size_t> kept(count);
+    for (size_t i = 0; i < count; i++) {
+      bool isFirst = i == 0 || lines[first + order[i]] !=
+                                   lines[first + order[i - 1]];
+      kept[order[i]] = isFirst ? order[i] : kept[order[i - 1]];
+    }
+    order.clear();
+    for (size_t row = 0; row < count; row++) {
+      if (kept[row] == row) {
+        targets[row] = order.size();
+        order.push_back(row);
+      }
+    }
+    for (size_t row = 0; row < count; row++) {
+      targets[row] = targets[kept[row]];
+    }
+  } else {
+    for (size_t i = 0; i < count; i++) {
+      targets[order[i]] = i;
+    }
+  }
+  notifyLinesWillChange(first, count);
+  std::vector<std::string> rows(order.size());
+  for (size_t i = 0; i < order.size(); i++) {
+    rows[i] = std::move(lines[first + order[i]]);
+  }
+  std::move(rows.begin(), rows.end(), lines.begin() + first);
+  lines.erase(lines.begin() + first + rows.size(),
+              lines.begin() + first + count);
+  notifyLinesChanged(first, count, rows.size());
+  std::string record{};
+  putIndex(record, first);
+  putIndex(record, count);
+  putIndex(record, rows.size());
+  record.append((const char*)targets.data(), count * sizeof(size_t));
+  bufOp.removedTexts.clear();
+  bufOp.removedTexts.push_back(std::move(record));
+  bufOp.oCursors.clear();
+  for (BufferCursor cursor : bufOp.iCursors) {
+    // unique may have removed the row
+    if (lines.size() > 0) {
+      size_t row = std::min(cursor.getRow(), lines.size() - 1);
+      cursor.moveSet(std::min(cursor.getCol(), lines[row].size()), row);
+    }
+    bufOp.oCursors.push_back(cursor);
+  }
+  return count;
+}
+void EditBuffer::undoReorder(const BufferOperation& bufOp) {
+  const std::string& record = bufOp.removedTexts[0];
+  size_t i = 0;
+  size_t first = getIndex(record, i);
+  size_t count = getIndex(record, i);
+  size_t keptCount = getIndex(record, i);
+  std::vector<size_t> targets(count);
+  memcpy(targets.data(), record.data() + i, count * sizeof(size_t));
+  // rows unique removed are copies of the row kept in their place, which
+  // the last of them can take
+  std::vector<size_t> uses(keptCount);
+  for (size_t target : targets) {
+    uses[target]++;
+  }
+  notifyLinesWillChange(first, keptCount);
+  std::vector<std::string> rows(count);
+  for (size_t row = 0; row < count; row++) {
+    std::string& kept = lines[first + targets[row]];
+    rows[row] = --uses[targets[row]] > 0 ? kept : std::move(kept);
+  }
+  lines.erase(lines.begin() + first, lines.begin() + first + keptCount);
+  lines.insert(lines.begin() + first, std::make_move_iterator(rows.begin()),
+               std::make_move_iterator(rows.end()));
+  notifyLinesChanged(first, keptCount, count);
+}
+void EditBuffer::applyFilter(BufferOperation& bufOp) {
+  size_t first = 0;
+  size_t count = 0;
+  getSelectedRows({bufOp.iCursors.begin(), bufOp.iCursors.end()}, first,
+                  count);
+  const std::vector<std::string>& rows = *bufOp.insertSlices[0];
+  // the replaced rows move into the operation rather than being copied
+  notifyLinesWillChange(first, count);
+  auto removed = new std::vector<std::string>(
+      std::make_move_iterator(lines.begin() + first),
+      std::make_move_iterator(lines.begin() + first + count));
+  lines.erase(lines.begin() + first, lines.begin() + first + count);
+  lines.insert(lines.begin() + first, rows.begin(), rows.end());
+  notifyLinesChanged(first, count, rows.size());
+  bufOp.removedSlices.assign(1, makeLineSlice(removed));
+  std::string record{};
+  putIndex(record, first);
+  bufOp.removedTexts.clear();
+  bufOp.removedTexts.push_back(std::move(record));
+  bufOp.oCursors.clear();
+  BufferCursor cursor{};
+  if (first < lines.size())
+    cursor.moveSet(0, first);
+  else if (lines.size() > 0)
+    cursor.moveSet(lines.back().size(), lines.size() - 1);
+  bufOp.oCursors.push_back(cursor);
+}
+void EditBuffer::undoFilter(const BufferOperation& bufOp) {
+  size_t i = 0;
+  size_t first = getIndex(bufOp.removedTexts[0], i);
+  size_t inserted = bufOp.insertSlices[0]->size();
+  const std::vector<std::string>& removed = *bufOp.removedSlices[0];
+  notifyLinesWillChange(first, inserted);
+  lines.erase(lines.begin() + first, lines.begin() + first + inserted);
+  lines.insert(lines.begin() + first, removed.begin(), removed.end());
+  notifyLinesChanged(first, inserted, removed.size());
+}
+void EditBuffer::getSelectedRows(const std::vector<BufferCursor>& cursors,
+                                 size_t& first,
+                                 size_t& count) const {
+  // a selection ending at the start of a row doesn't take that row
+  first = std::string::npos;
+  size_t last = 0;
+  for (const BufferCursor& cursor : cursors) {
+    BufferPosition start =
+        std::min(cursor.getPosition(), cursor.getTailPosition());
+    BufferPosition end =
+        std::max(cursor.getPosition(), cursor.getTailPosition());
+    if (start == end)
+      continue;
+    first = std::min(first, start.row);
+    last = std::max(last, end.col == 0 && end.row > start.row ? end.row - 1
+                                                              : end.row);
+  }
+  if (first == std::string::npos) {
+    first = 0;
+    count = lines.size();
+    return;
+  }
+  last = std::min(last + 1, lines.size());
+  first = std::min(first, last);
+  count = last - first;
+}
+void EditBuffer::setRows(std::vector<std::vector<RowChange>>& shards) {
+  // swap the new rows in, leaving what they held in the changes
+  notifyRowsWillMove();
+  for (std::vector<RowChange>& shard : shards) {
+    for (RowChange& change : shard) {
+      accountedBytes += MemoryStats::addString(MS_LINES, lines[change.row], -1);
+      lines[change.row].swap(change.text);
+      accountedBytes += MemoryStats::addString(MS_LINES, lines[change.row], 1);
+    }
+  }
+  for (BufferObserver* observer : observers) {
+    observer->rowsReplaced(*this, shards);
+  }
+}
+void EditBuffer::addObserver(BufferObserver* observer) {
+  observers.push_back(observer);
+}
+void EditBuffer::removeObserver(BufferObserver* observer) {
+  observers.erase(std::remove(observers.begin(), observers.end(), observer),
+                  observers.end());
+}
+void EditBuffer::accountLines(size_t row, size_t count, int sign) {
+  for (size_t i = row; i < row + count; i++) {
+    accountedBytes += MemoryStats::addString(MS_LINES, lines[i], sign);
+  }
+}
+void EditBuffer::accountCapacity() {
+  size_t capacity = lines.capacity() * sizeof(std::string);
+  if (capacity == accountedCapacity)
+    return;
+  long long allocations = (capacity > 0) - (accountedCapacity > 0);
+  MemoryStats::add(MS_LINES, (long long)capacity - (long long)accountedCapacity,
+                   allocations);
+  accountedCapacity = capacity;
+}
+void EditBuffer::notifyRowsWillMove() {
+  for (BufferObserver* observer : observers) {
+    observer->rowsWillMove(*this);
+  }
+}
+void EditBuffer::notifyLinesWillChange(size_t row,
+                                       size_t count,
+                                       bool isInPlace) {
+  if (!isInPlace)
+    notifyRowsWillMove();
+  accountLines(row, count, -1);
+  for (BufferObserver* observer : observers) {
+    observer->linesWillChange(*this, row, count);
+  }
+}
+void EditBuffer::notifyLinesChanged(size_t row,
+                                    size_t removed,
+                                    size_t inserted) {
+  accountLines(row, inserted, 1);
+  accountCapacity();
+  for (BufferObserver* observer : observers) {
+    observer->linesChanged(*this, row, removed, inserted);
+  }
+}
+void EditBuffer::notifyLinesRotated(size_t first, size_t middle, size_t last) {
+  for (BufferObserver* observer : observers) {
+    observer->linesRotated(*this, first, middle, last);
   }
 }
 void EditBuffer::slideUpAtCursor(BufferCursor& cursor) {
@@ -157,14 +825,11 @@ void EditBuffer::slideUpAtCursor(BufferCursor& cursor) {
   BufferPosition end = std::max(a, b);
   if (start.row <= 0)
     return;
-  // copy the line above
-  std::string preLine = "\n" + lines[start.row - 1];
-  // delete the line above
-  lines.erase(lines.begin() + start.row - 1);
-  // insert the copy at the end of the last line of the selection
-  BufferPosition insertPos{end.row - 1, lines[end.row - 1].size()};
-  BufferCursor insertCursor{insertPos};
-  insertTextAtCursor(insertCursor, preLine);
+  // rotate the line above to below the last line of the selection
+  notifyRowsWillMove();
+  std::rotate(lines.begin() + start.row - 1, lines.begin() + start.row,
+              lines.begin() + end.row + 1);
+  notifyLinesRotated(start.row - 1, start.row, end.row + 1);
   // move cursor up a row
   cursor.moveSet(b.col, b.row - 1);
   cursor.selectSet(a.col, a.row - 1);
@@ -176,20 +841,27 @@ void EditBuffer::slideDownAtCursor(BufferCursor& cursor) {
   BufferPosition end = std::max(a, b);
   if (end.row >= lines.size() - 1)
     return;
-  // copy the line below
-  std::string postLine = lines[end.row + 1] + "\n";
-  // delete the line below
-  lines.erase(lines.begin() + end.row + 1);
-  // insert copy at beginning of line of first line of selection
-  BufferPosition insertPos{start.row, 0};
-  BufferCursor insertCursor{insertPos};
-  insertTextAtCursor(insertCursor, postLine);
+  // rotate the line below to above the first line of the selection
+  notifyRowsWillMove();
+  std::rotate(lines.begin() + start.row, lines.begin() + end.row + 1,
+              lines.begin() + end.row + 2);
+  notifyLinesRotated(start.row, end.row + 1, end.row + 2);
   // move cursor down
   cursor.moveSet(b.col, b.row + 1);
   cursor.selectSet(a.col, a.row + 1);
 }
 void EditBuffer::insertTextAtCursor(BufferCursor& cursor,
                                     const std::string& text) {
+  if (text.find('\n') == std::string::npos) {
+    // typing: edit the row in place
+    size_t cRow = cursor.getRow();
+    size_t cCol = std::min(cursor.getCol(), lines[cRow].size());
+    notifyLinesWillChange(cRow, 1, true);
+    lines[cRow].insert(cCol, text);
+    notifyLinesChanged(cRow, 1, 1);
+    cursor.moveSet(cCol + text.size(), cRow);
+    return;
+  }
   std::vector<std::string> insertLines{};
   std::string insertLine{};
   for (int i = 0; i <= (int)text.size(); i++) {
@@ -210,8 +882,10 @@ void EditBuffer::insertTextAtCursor(BufferCursor& cursor,
   insertLines[0] = preString + insertLines[0];
   insertLines[insertLines.size() - 1] =
       insertLines[insertLines.size() - 1] + postString;
+  notifyLinesWillChange(cRow, 1);
   lines.erase(lines.begin() + cRow);
   lines.insert(lines.begin() + cRow, insertLines.begin(), insertLines.end());
+  notifyLinesChanged(cRow, 1, insertLines.size());
   cRow += insertLines.size() - 1;
   cCol = lastLineLength;
   if (insertLines.size() == 1) {
@@ -219,6 +893,25 @@ void EditBuffer::insertTextAtCursor(BufferCursor& cursor,
   }
   cursor.moveSet(cCol, cRow);
 }
+void EditBuffer::insertLinesAtCursor(BufferCursor& cursor,
+                                     const std::vector<std::string>& slice) {
+  size_t cRow = cursor.getRow();
+  size_t cCol = std::min(cursor.getCol(), lines[cRow].size());
+  notifyLinesWillChange(cRow, 1, slice.size() == 1);
+  if (slice.size() == 1) {
+    lines[cRow].insert(cCol, slice[0]);
+    notifyLinesChanged(cRow, 1, 1);
+    cursor.moveSet(cCol + slice[0].size(), cRow);
+    return;
+  }
+  std::string postString = lines[cRow].substr(cCol);
+  lines[cRow].replace(cCol, std::string::npos, slice[0]);
+  lines.insert(lines.begin() + cRow + 1, slice.begin() + 1, slice.end());
+  size_t lastRow = cRow + slice.size() - 1;
+  lines[lastRow].append(postString);
+  notifyLinesChanged(cRow, 1, slice.size());
+  cursor.moveSet(slice.back().size(), lastRow);
+}
 void EditBuffer::backspaceAtCursor(BufferCursor& cursor,
                                    std::string& removedText) {
   int cRow = cursor.getRow();
@@ -266,14 +959,18 @@ std::string EditBuffer::clearSelection(BufferCursor& cursor) {
   }
   if (start.row == end.row) {
     // single row
+    notifyLinesWillChange(start.row, 1, true);
     lines[start.row].erase(lines[start.row].begin() + start.col,
                            lines[start.row].begin() + end.col);
+    notifyLinesChanged(start.row, 1, 1);
   } else {
     // multi-row
+    notifyLinesWillChange(start.row, end.row - start.row + 1);
     std::string tailString = lines[end.row].substr(end.col);
     lines[start.row].replace(start.col, lines[start.row].size() - start.col,
                              tailString);
     lines.erase(lines.begin() + start.row + 1, lines.begin() + end.row + 1);
+    notifyLinesChanged(start.row, end.row - start.row + 1, 1);
   }
   cursor.moveSet(start.col, start.row);
   return removedText;
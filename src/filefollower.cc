@@ -0,0 +1,79 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <memory>
+#include "pane.hh"
+
+namespace {
+constexpr size_t READ_SIZE = 1024 * 1024;
+// stop catching up after this much per poll so typing stays responsive
+constexpr long long MAX_POLL_BYTES = 64 * 1024 * 1024;
+}  // namespace
+
+FileFollower::~FileFollower() {
+  stop();
+}
+bool FileFollower::start(const std::string& filename, long long offset) {
+  stop();
+  fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+  inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (fd < 0 || inotifyFd < 0 ||
+      inotify_add_watch(inotifyFd, filename.c_str(), IN_MODIFY) < 0) {
+    stop();
+    return false;
+  }
+  this->offset = offset;
+  // the buffer's last row is still open when the file didn't end in a newline
+  char last = '\n';
+  continuesLastRow = offset > 0 && pread(fd, &last, 1, offset - 1) == 1 &&
+                     last != '\n';
+  return true;
+}
+void FileFollower::stop() {
+  if (fd >= 0)
+    close(fd);
+  if (inotifyFd >= 0)
+    close(inotifyFd);
+  fd = -1;
+  inotifyFd = -1;
+}
+bool FileFollower::isFollowing() const {
+  return fd >= 0;
+}
+bool FileFollower::poll(EditBuffer& buf) {
+  if (fd < 0)
+    return false;
+  char events[4096];
+  // a poll that stopped early has more to read without a new event
+  bool isModified = isBehind;
+  while (read(inotifyFd, events, sizeof(events)) > 0) {
+    isModified = true;
+  }
+  if (!isModified)
+    return false;
+  struct stat st {};
+  if (fstat(fd, &st) == 0 && st.st_size < offset) {
+    // truncated, likely rotated. follow from the start again
+    offset = 0;
+    continuesLastRow = false;
+  }
+  std::unique_ptr<char[]> chunk{new char[READ_SIZE]};
+  long long polled = 0;
+  bool isAppended = false;
+  while (polled < MAX_POLL_BYTES) {
+    ssize_t bytesRead = pread(fd, chunk.get(), READ_SIZE, offset);
+    if (bytesRead < 0 && errno == EINTR)
+      continue;
+    if (bytesRead <= 0)
+      break;
+    buf.appendText(chunk.get(), bytesRead, continuesLastRow);
+    continuesLastRow = chunk[bytesRead - 1] != '\n';
+    offset += bytesRead;
+    polled += bytesRead;
+    isAppended = true;
+  }
+  isBehind = polled >= MAX_POLL_BYTES;
+  return isAppended;
+}
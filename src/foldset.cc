@@ -0,0 +1,125 @@
+#include <algorithm>
+#include "pane.hh"
+
+bool FoldSet::fold(size_t first, size_t last) {
+  if (first == 0 || first >= last || isHidden(first - 1))
+    return false;
+  // folds inside the new one are swallowed. a fold crossing it, or headed by
+  // its last row, can't be
+  size_t begin = findFold(first - 1);
+  size_t end = begin;
+  while (end < folds.size() && folds[end].last <= last)
+    end++;
+  if (end < folds.size() && folds[end].first <= last)
+    return false;
+  folds.erase(folds.begin() + begin, folds.begin() + end);
+  folds.insert(folds.begin() + begin, Fold{first, last});
+  count();
+  return true;
+}
+size_t FoldSet::unfold(size_t row) {
+  // the fold row heads, or else the one hiding it
+  size_t index = findFold(row + 1);
+  if (index == 0 || folds[index - 1].last <= row)
+    return 0;
+  size_t hidden = folds[index - 1].last - folds[index - 1].first;
+  folds.erase(folds.begin() + index - 1);
+  count();
+  return hidden;
+}
+void FoldSet::clear() {
+  folds.clear();
+  count();
+}
+const std::vector<Fold>& FoldSet::getFolds() const {
+  return folds;
+}
+const Fold* FoldSet::getFold(size_t row) const {
+  size_t index = findFold(row + 1);
+  if (index == 0 || folds[index - 1].first != row + 1)
+    return nullptr;
+  return &folds[index - 1];
+}
+bool FoldSet::isHidden(size_t row) const {
+  size_t index = findFold(row);
+  return index > 0 && row < folds[index - 1].last;
+}
+size_t FoldSet::getVisibleRow(size_t row) const {
+  size_t index = findFold(row);
+  if (index > 0 && row < folds[index - 1].last)
+    return folds[index - 1].first - 1;
+  return row;
+}
+size_t FoldSet::getNextRow(size_t row) const {
+  const Fold* fold = getFold(row);
+  return fold != nullptr ? fold->last : row + 1;
+}
+size_t FoldSet::getHiddenCount() const {
+  return hiddenBefore.back();
+}
+size_t FoldSet::getScreenRow(size_t row) const {
+  row = getVisibleRow(row);
+  return row - hiddenBefore[findFold(row)];
+}
+size_t FoldSet::getRow(size_t screenRow) const {
+  // the folds starting at or before the row are the ones whose first hidden
+  // row would have been at or before screenRow
+  size_t low = 0;
+  size_t high = folds.size();
+  while (low < high) {
+    size_t middle = (low + high) / 2;
+    if (folds[middle].first - hiddenBefore[middle] <= screenRow)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+  return screenRow + hiddenBefore[low];
+}
+void FoldSet::bufferLoaded(const EditBuffer&, const std::string&) {
+  clear();
+}
+void FoldSet::linesChanged(const EditBuffer&,
+                           size_t row,
+                           size_t removed,
+                           size_t inserted) {
+  if (folds.size() == 0)
+    return;
+  // a fold opens when its hidden rows change, and moves with the rows above it.
+  // rows inserted right under a fold's first row would be hidden by it too
+  size_t changedEnd = row + std::max<size_t>(removed, 1);
+  size_t index = findFold(row);
+  if (index > 0 && folds[index - 1].last > row)
+    index--;
+  size_t kept = index;
+  for (size_t i = index; i < folds.size(); i++) {
+    Fold fold = folds[i];
+    if (changedEnd > fold.first && row < fold.last)
+      continue;
+    if (row + removed <= fold.first) {
+      fold.first = fold.first + inserted - removed;
+      fold.last = fold.last + inserted - removed;
+    }
+    // the row heading it was removed
+    if (fold.first == 0)
+      continue;
+    folds[kept++] = fold;
+  }
+  folds.resize(kept);
+  count();
+}
+
+size_t FoldSet::findFold(size_t row) const {
+  // the number of folds whose first hidden row is at or before row
+  return std::upper_bound(folds.begin(), folds.end(), row,
+                          [](size_t value, const Fold& fold) {
+                            return value < fold.first;
+                          }) -
+         folds.begin();
+}
+void FoldSet::count() {
+  hiddenBefore.resize(folds.size() + 1);
+  hiddenBefore[0] = 0;
+  for (size_t i = 0; i < folds.size(); i++) {
+    hiddenBefore[i + 1] = hiddenBefore[i] + folds[i].last - folds[i].first;
+  }
+}
@@ -0,0 +1,239 @@
+#include <ctype.h>
+#include <algorithm>
+#include <string_view>
+#include <unordered_set>
+#include "pane.hh"
+
+namespace {
+const std::unordered_set<std::string_view> KEYWORDS{
+    "alignas",   "alignof",      "auto",      "bool",      "break",
+    "case",      "catch",        "char",      "class",     "const",
+    "constexpr", "const_cast",   "continue",  "decltype",  "default",
+    "delete",    "do",           "double",    "dynamic_cast", "else",
+    "enum",      "explicit",     "extern",    "false",     "float",
+    "for",       "friend",       "goto",      "if",        "inline",
+    "int",       "long",         "mutable",   "namespace", "new",
+    "noexcept",  "nullptr",      "operator",  "override",  "private",
+    "protected", "public",       "register",  "reinterpret_cast", "return",
+    "short",     "signed",       "sizeof",    "static",    "static_assert",
+    "static_cast", "struct",     "switch",    "template",  "this",
+    "throw",     "true",         "try",       "typedef",   "typename",
+    "union",     "unsigned",     "using",     "virtual",   "void",
+    "volatile",  "while",
+};
+const std::vector<std::string> EXTENSIONS{".c",  ".cc", ".cpp", ".cxx",
+                                          ".h",  ".hh", ".hpp", ".hxx"};
+const std::vector<StyleRun> NO_RUNS{};
+
+bool isIdentChar(char c) {
+  return isalnum((unsigned char)c) || c == '_';
+}
+}  // namespace
+
+void Highlighter::setLanguage(const std::string& filename) {
+  isEnabled = false;
+  for (const std::string& ext : EXTENSIONS) {
+    if (filename.size() >= ext.size() &&
+        filename.compare(filename.size() - ext.size(), ext.size(), ext) == 0) {
+      isEnabled = true;
+    }
+  }
+  clear();
+}
+void Highlighter::bufferLoaded(const EditBuffer&,
+                               const std::string& filename) {
+  setLanguage(filename);
+}
+void Highlighter::linesChanged(const EditBuffer&,
+                               size_t row,
+                               size_t removed,
+                               size_t inserted) {
+  if (!isEnabled || row >= runs.size())
+    return;
+  size_t end = std::min(row + removed, runs.size());
+  // the first replacement row is entered with the state the first replaced row
+  // was entered with, since the row above it did not change
+  LexState entering = startStates[row];
+  spliceRowValues(startStates, row, end - row, inserted, LS_CODE);
+  spliceRowValues(dirtyRows, row, end - row, inserted, (char)1);
+  spliceRowValues(runs, row, end - row, inserted, NO_RUNS);
+  // shift the dirty range along with the rows it covers
+  if (firstDirtyRow <= lastDirtyRow) {
+    if (firstDirtyRow >= end)
+      firstDirtyRow = firstDirtyRow - (end - row) + inserted;
+    else if (firstDirtyRow > row)
+      firstDirtyRow = row;
+    if (lastDirtyRow >= end)
+      lastDirtyRow = lastDirtyRow - (end - row) + inserted;
+    else if (lastDirtyRow >= row)
+      lastDirtyRow = row;
+  }
+  if (row >= runs.size())
+    return;
+  startStates[row] = entering;
+  markDirty(row);
+  if (inserted > 1)
+    markDirty(row + inserted - 1);
+}
+void Highlighter::linesRotated(const EditBuffer& buf,
+                               size_t first,
+                               size_t middle,
+                               size_t last) {
+  if (!isEnabled || first >= runs.size())
+    return;
+  if (last > runs.size()) {
+    linesChanged(buf, first, runs.size() - first, runs.size() - first);
+    return;
+  }
+  // the moved rows keep their runs; only the rows after each seam may now be
+  // entered with a different state. the rows before the seams are re-lexed to
+  // carry their end states over
+  LexState entering = startStates[first];
+  std::rotate(startStates.begin() + first, startStates.begin() + middle,
+              startStates.begin() + last);
+  std::rotate(dirtyRows.begin() + first, dirtyRows.begin() + middle,
+              dirtyRows.begin() + last);
+  std::rotate(runs.begin() + first, runs.begin() + middle,
+              runs.begin() + last);
+  startStates[first] = entering;
+  markDirty(first);
+  markDirty(first + last - middle - 1);
+  markDirty(first + last - middle);
+  markDirty(last - 1);
+  if (last < runs.size())
+    markDirty(last);
+}
+void Highlighter::update(const EditBuffer& buf, size_t lastRow) {
+  if (!isEnabled)
+    return;
+  size_t target = std::min(lastRow + 1, buf.lines.size());
+  if (runs.size() < target) {
+    size_t oldSize = runs.size();
+    startStates.resize(target, LS_CODE);
+    dirtyRows.resize(target, 1);
+    runs.resize(target);
+    // re-lex the last cached row so its end state reaches the new rows
+    markDirty(oldSize > 0 ? oldSize - 1 : 0);
+    markDirty(target - 1);
+  }
+  size_t row = firstDirtyRow;
+  while (row <= lastDirtyRow && row < target) {
+    if (dirtyRows[row]) {
+      LexState state = lexLine(buf.lines[row], startStates[row], runs[row]);
+      dirtyRows[row] = 0;
+      if (row + 1 < runs.size() &&
+          (dirtyRows[row + 1] || startStates[row + 1] != state)) {
+        startStates[row + 1] = state;
+        markDirty(row + 1);
+      }
+    }
+    row++;
+  }
+  firstDirtyRow = row;
+  if (firstDirtyRow > lastDirtyRow) {
+    firstDirtyRow = 1;
+    lastDirtyRow = 0;
+  }
+}
+const std::vector<StyleRun>& Highlighter::getRuns(size_t row) const {
+  if (!isEnabled || row >= runs.size())
+    return NO_RUNS;
+  return runs[row];
+}
+
+void Highlighter::markDirty(size_t row) {
+  dirtyRows[row] = 1;
+  if (firstDirtyRow > lastDirtyRow) {
+    firstDirtyRow = row;
+    lastDirtyRow = row;
+    return;
+  }
+  firstDirtyRow = std::min(firstDirtyRow, row);
+  lastDirtyRow = std::max(lastDirtyRow, row);
+}
+void Highlighter::clear() {
+  startStates.clear();
+  dirtyRows.clear();
+  runs.clear();
+  firstDirtyRow = 1;
+  lastDirtyRow = 0;
+}
+LexState Highlighter::lexLine(const std::string& line,
+                              LexState state,
+                              std::vector<StyleRun>& lineRuns) const {
+  lineRuns.clear();
+  auto addRun = [&lineRuns](size_t start, PALETTES color) {
+    // text before the first run is drawn as N_TEXT
+    if (lineRuns.empty() && color == N_TEXT)
+      return;
+    if (!lineRuns.empty() && lineRuns.back().color == color)
+      return;
+    lineRuns.push_back(StyleRun{start, color});
+  };
+  size_t n = line.size();
+  size_t i = 0;
+  bool isLineStart = true;
+  while (i < n) {
+    if (state == LS_BLOCK_COMMENT) {
+      addRun(i, N_COMMENT);
+      size_t close = line.find("*/", i);
+      if (close == std::string::npos)
+        return LS_BLOCK_COMMENT;
+      i = close + 2;
+      state = LS_CODE;
+      isLineStart = false;
+      continue;
+    }
+    char c = line[i];
+    char next = i + 1 < n ? line[i + 1] : '\0';
+    if (c == ' ' || c == '\t') {
+      addRun(i, N_TEXT);
+      i++;
+      continue;
+    }
+    if (c == '/' && next == '/') {
+      addRun(i, N_COMMENT);
+      return LS_CODE;
+    }
+    if (c == '/' && next == '*') {
+      addRun(i, N_COMMENT);
+      state = LS_BLOCK_COMMENT;
+      i += 2;
+      continue;
+    }
+    if (c == '#' && isLineStart) {
+      // the directive name: "#  include"
+      addRun(i, N_PREPROC);
+      i++;
+      while (i < n && (line[i] == ' ' || line[i] == '\t'))
+        i++;
+      while (i < n && isIdentChar(line[i]))
+        i++;
+    } else if (c == '"' || c == '\'') {
+      addRun(i, N_STRING);
+      i++;
+      while (i < n && line[i] != c) {
+        if (line[i] == '\\')
+          i++;
+        i++;
+      }
+      i = std::min(i + 1, n);
+    } else if (isdigit((unsigned char)c)) {
+      addRun(i, N_NUMBER);
+      while (i < n && (isIdentChar(line[i]) || line[i] == '.' ||
+                       line[i] == '\''))
+        i++;
+    } else if (isIdentChar(c)) {
+      size_t start = i;
+      while (i < n && isIdentChar(line[i]))
+        i++;
+      std::string_view word{line.data() + start, i - start};
+      addRun(start, KEYWORDS.count(word) ? N_KEYWORD : N_TEXT);
+    } else {
+      addRun(i, N_TEXT);
+      i++;
+    }
+    isLineStart = false;
+  }
+  return state;
+}
@@ -0,0 +1,326 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include "pane.hh"
+
+namespace {
+const std::string MAGIC{"NEDJRNL1"};
+// how long the writer waits for more records before writing and syncing
+constexpr std::chrono::milliseconds GROUP_COMMIT_DELAY{50};
+
+std::string getJournalPath(const std::string& filename) {
+  return filename + ".ned-journal";
+}
+
+void putNumber(std::string& out, unsigned long long n) {
+  while (n >= 0x80) {
+    out.push_back((char)(n | 0x80));
+    n >>= 7;
+  }
+  out.push_back((char)n);
+}
+void putText(std::string& out, const std::string& text) {
+  putNumber(out, text.size());
+  out.append(text);
+}
+bool getNumber(const std::string& in, size_t& i, unsigned long long& n) {
+  n = 0;
+  for (int shift = 0; i < in.size() && shift < 64; shift += 7) {
+    unsigned char byte = in[i++];
+    n |= (unsigned long long)(byte & 0x7f) << shift;
+    if (!(byte & 0x80))
+      return true;
+  }
+  return false;
+}
+bool getText(const std::string& in, size_t& i, std::string& text) {
+  unsigned long long size{};
+  if (!getNumber(in, i, size) || size > in.size() - i)
+    return false;
+  text.assign(in, i, size);
+  i += size;
+  return true;
+}
+
+unsigned int getChecksum(const std::string& data) {
+  // fnv-1a
+  unsigned int hash = 2166136261u;
+  for (char c : data) {
+    hash = (hash ^ (unsigned char)c) * 16777619u;
+  }
+  return hash;
+}
+
+// the file as it is now, which the first record applies to
+std::string makeHeader(const std::string& filename) {
+  struct stat st {};
+  stat(filename.c_str(), &st);
+  std::string header{MAGIC};
+  putNumber(header, st.st_size);
+  putNumber(header, st.st_mtim.tv_sec * 1000000000ULL + st.st_mtim.tv_nsec);
+  return header;
+}
+
+// length, checksum, then the payload
+std::string encodeRecord(JournalRecordType type,
+                         const BufferOperation* bufOp) {
+  std::string payload{};
+  payload.push_back(type);
+  if (type == JR_DO) {
+    payload.push_back(bufOp->opType);
+    putNumber(payload, bufOp->iCursors.size());
+    for (const BufferCursor& cursor : bufOp->iCursors) {
+      putNumber(payload, cursor.getRow());
+      putNumber(payload, cursor.getCol());
+      putNumber(payload, cursor.getTailRow());
+      putNumber(payload, cursor.getTailCol());
+    }
+    putNumber(payload, bufOp->insertTexts.size());
+    for (const std::string& text : bufOp->insertTexts) {
+      putText(payload, text);
+    }
+    putNumber(payload, bufOp->insertSlices.size());
+    for (const LineSlice& slice : bufOp->insertSlices) {
+      putNumber(payload, slice->size());
+      for (const std::string& row : *slice) {
+        putText(payload, row);
+      }
+    }
+  }
+  std::string record{};
+  putNumber(record, payload.size());
+  unsigned int checksum = getChecksum(payload);
+  for (int i = 0; i < 4; i++) {
+    record.push_back((char)(checksum >> (8 * i)));
+  }
+  record.append(payload);
+  return record;
+}
+bool decodeRecord(const std::string& payload, JournalRecord& record) {
+  size_t i = 0;
+  if (payload.size() == 0)
+    return false;
+  record.type = (JournalRecordType)payload[i++];
+  if (record.type == JR_UNDO || record.type == JR_REDO)
+    return i == payload.size();
+  if (record.type != JR_DO || i >= payload.size())
+    return false;
+  BufferOperation& bufOp = record.bufOp;
+  bufOp.opType = (BufOpType)payload[i++];
+  if (bufOp.opType > BO_FILTER)
+    return false;
+  unsigned long long count{};
+  if (!getNumber(payload, i, count) || count > payload.size())
+    return false;
+  for (unsigned long long c = 0; c < count; c++) {
+    unsigned long long row{}, col{}, tailRow{}, tailCol{};
+    if (!getNumber(payload, i, row) || !getNumber(payload, i, col) ||
+        !getNumber(payload, i, tailRow) || !getNumber(payload, i, tailCol))
+      return false;
+    BufferCursor cursor{};
+    cursor.moveSet(tailCol, tailRow);
+    cursor.selectSet(col, row);
+    bufOp.iCursors.push_back(cursor);
+  }
+  if (!getNumber(payload, i, count) || count > payload.size())
+    return false;
+  for (unsigned long long t = 0; t < count; t++) {
+    std::string text{};
+    if (!getText(payload, i, text))
+      return false;
+    bufOp.insertTexts.push_back(std::move(text));
+  }
+  if (!getNumber(payload, i, count) || count > payload.size())
+    return false;
+  for (unsigned long long s = 0; s < count; s++) {
+    unsigned long long rowCount{};
+    if (!getNumber(payload, i, rowCount) || rowCount > payload.size())
+      return false;
+    std::vector<std::string> rows(rowCount);
+    for (std::string& row : rows) {
+      if (!getText(payload, i, row))
+        return false;
+    }
+    // accounted like every other slice, once its rows are read
+    bufOp.insertSlices.push_back(
+        makeLineSlice(new std::vector<std::string>(std::move(rows))));
+  }
+  return i == payload.size();
+}
+
+bool writeAll(int fd, const std::string& data) {
+  size_t written = 0;
+  while (written < data.size()) {
+    ssize_t n = write(fd, data.data() + written, data.size() - written);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0)
+      return false;
+    written += n;
+  }
+  return true;
+}
+}  // namespace
+
+Journal::~Journal() {
+  remove();
+}
+void Journal::open(const std::string& filename, long long validLength) {
+  stop();
+  path = getJournalPath(filename);
+  header = makeHeader(filename);
+  // continue a replayed journal after its last intact record
+  isStarted = validLength > 0 && truncate(path.c_str(), validLength) == 0;
+  if (!isStarted)
+    unlink(path.c_str());
+  isOpen = true;
+}
+void Journal::rebase(const std::string& filename,
+                     const std::vector<BufferOperation>& bufOps,
+                     size_t first,
+                     size_t undoCount) {
+  if (getJournalPath(filename) != path)
+    remove();
+  stop();
+  path = getJournalPath(filename);
+  header = makeHeader(filename);
+  isOpen = true;
+  std::string records{};
+  for (size_t i = first; i < bufOps.size(); i++) {
+    records.append(encodeRecord(JR_DO, &bufOps[i]));
+  }
+  for (size_t i = 0; i < undoCount; i++) {
+    records.append(encodeRecord(JR_UNDO, nullptr));
+  }
+  unlink(path.c_str());
+  isStarted = false;
+  if (records.size() > 0)
+    append(records);
+}
+void Journal::remove() {
+  stop();
+  if (isOpen)
+    unlink(path.c_str());
+  isOpen = false;
+  isStarted = false;
+}
+void Journal::recordOperation(const BufferOperation& bufOp) {
+  if (isOpen)
+    append(encodeRecord(JR_DO, &bufOp));
+}
+void Journal::recordUndo() {
+  if (isOpen)
+    append(encodeRecord(JR_UNDO, nullptr));
+}
+void Journal::recordRedo() {
+  if (isOpen)
+    append(encodeRecord(JR_REDO, nullptr));
+}
+long long Journal::read(const std::string& filename,
+                        std::vector<JournalRecord>& records) {
+  std::ifstream ifile{getJournalPath(filename).c_str(), std::ios::binary};
+  if (!ifile.is_open())
+    return 0;
+  std::stringstream contents{};
+  contents << ifile.rdbuf();
+  std::string journal = contents.str();
+  std::string header = makeHeader(filename);
+  if (journal.compare(0, header.size(), header) != 0) {
+    std::cout << "ERROR:Journal::read " << filename
+              << " changed since its journal was started, ignoring it"
+              << std::endl;
+    return 0;
+  }
+  // a crash can leave the last record partly written
+  size_t validLength = header.size();
+  size_t i = validLength;
+  while (i < journal.size()) {
+    unsigned long long size{};
+    if (!getNumber(journal, i, size) || size + 4 > journal.size() - i)
+      break;
+    unsigned int checksum = 0;
+    for (int b = 0; b < 4; b++) {
+      checksum |= (unsigned int)(unsigned char)journal[i++] << (8 * b);
+    }
+    std::string payload = journal.substr(i, size);
+    i += size;
+    JournalRecord record{};
+    if (checksum != getChecksum(payload) || !decodeRecord(payload, record))
+      break;
+    records.push_back(std::move(record));
+    validLength = i;
+  }
+  return validLength;
+}
+
+void Journal::append(const std::string& record) {
+  std::lock_guard<std::mutex> lock{mutex};
+  if (!isStarted) {
+    pending = header;
+    isResetPending = true;
+    isStarted = true;
+  }
+  pending.append(record);
+  if (!writer.joinable())
+    writer = std::thread(&Journal::writeBatches, this);
+  wakeup.notify_one();
+}
+void Journal::stop() {
+  if (!writer.joinable())
+    return;
+  {
+    std::lock_guard<std::mutex> lock{mutex};
+    isStopping = true;
+  }
+  wakeup.notify_one();
+  writer.join();
+  isStopping = false;
+}
+void Journal::writeBatches() {
+  int fd = -1;
+  std::unique_lock<std::mutex> lock{mutex};
+  while (true) {
+    wakeup.wait(lock, [this]() { return pending.size() > 0 || isStopping; });
+    if (pending.size() == 0)
+      break;
+    // let a burst of keystrokes share one write and one sync
+    wakeup.wait_for(lock, GROUP_COMMIT_DELAY, [this]() { return isStopping; });
+    std::string batch{};
+    batch.swap(pending);
+    bool isReset = isResetPending;
+    isResetPending = false;
+    lock.unlock();
+    if (isReset) {
+      // a new journal replaces the old one whole
+      if (fd >= 0)
+        close(fd);
+      std::string tmpPath = path + ".tmp";
+      int tmpFd = ::open(tmpPath.c_str(),
+                         O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+      if (tmpFd < 0 || !writeAll(tmpFd, batch) || fdatasync(tmpFd) < 0 ||
+          rename(tmpPath.c_str(), path.c_str()) < 0) {
+        std::cout << "ERROR:Journal " << tmpPath << ": " << strerror(errno)
+                  << std::endl;
+      }
+      if (tmpFd >= 0)
+        close(tmpFd);
+      fd = ::open(path.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+    } else {
+      if (fd < 0)
+        fd = ::open(path.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+      if (fd < 0 || !writeAll(fd, batch) || fdatasync(fd) < 0) {
+        std::cout << "ERROR:Journal " << path << ": " << strerror(errno)
+                  << std::endl;
+      }
+    }
+    lock.lock();
+  }
+  if (fd >= 0)
+    close(fd);
+}
@@ -0,0 +1,199 @@
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <functional>
+#include <string_view>
+#include "pane.hh"
+
+namespace {
+// past this many inserted and removed rows the rest is replaced as a whole
+constexpr long MAX_EDIT_DISTANCE = 2048;
+
+struct Row {
+  size_t offset{};
+  size_t size{};
+  size_t hash{};
+};
+
+size_t getThreadCount(size_t work) {
+  size_t threads = std::max(1u, std::thread::hardware_concurrency());
+  return std::min(threads, work / 4096 + 1);
+}
+
+// splits contents into rows the way loadFromFile does, a chunk per thread
+std::vector<Row> hashRows(const std::string& contents) {
+  size_t threadCount = getThreadCount(contents.size() / 64);
+  std::vector<std::vector<Row>> chunks(threadCount);
+  std::vector<std::thread> threads{};
+  for (size_t t = 0; t < threadCount; t++) {
+    threads.emplace_back([&contents, &chunks, t, threadCount]() {
+      // each chunk holds the rows starting inside it
+      size_t start = contents.size() * t / threadCount;
+      size_t end = contents.size() * (t + 1) / threadCount;
+      if (start > 0 && contents[start - 1] != '\n') {
+        const char* newline = (const char*)memchr(
+            contents.data() + start, '\n', contents.size() - start);
+        start = newline ? newline - contents.data() + 1 : contents.size();
+      }
+      const std::hash<std::string_view> hasher{};
+      while (start < end) {
+        const char* newline = (const char*)memchr(
+            contents.data() + start, '\n', contents.size() - start);
+        size_t rowEnd = newline ? newline - contents.data() : contents.size();
+        std::string_view row{contents.data() + start, rowEnd - start};
+        chunks[t].push_back(Row{start, row.size(), hasher(row)});
+        start = rowEnd + 1;
+      }
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  std::vector<Row> rows{};
+  for (std::vector<Row>& chunk : chunks) {
+    rows.insert(rows.end(), chunk.begin(), chunk.end());
+  }
+  return rows;
+}
+std::vector<size_t> hashLines(const std::vector<std::string>& lines) {
+  std::vector<size_t> hashes(lines.size());
+  size_t threadCount = getThreadCount(lines.size());
+  std::vector<std::thread> threads{};
+  for (size_t t = 0; t < threadCount; t++) {
+    threads.emplace_back([&lines, &hashes, t, threadCount]() {
+      const std::hash<std::string_view> hasher{};
+      size_t end = lines.size() * (t + 1) / threadCount;
+      for (size_t i = lines.size() * t / threadCount; i < end; i++) {
+        hashes[i] = hasher(lines[i]);
+      }
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  return hashes;
+}
+
+// the edit script from myers' greedy algorithm, as (x, y) points along the
+// path from (0, 0) to (n, m). empty when the distance is over the bound
+template <typename Equal>
+std::vector<std::pair<long, long>> getMyersPath(long n, long m, Equal equal) {
+  long bound = std::min(n + m, MAX_EDIT_DISTANCE);
+  std::vector<long> v(2 * bound + 3, 0);
+  long offset = bound + 1;
+  std::vector<std::vector<long>> trace{};
+  for (long d = 0; d <= bound; d++) {
+    trace.emplace_back(v.begin() + offset - d - 1, v.begin() + offset + d + 2);
+    for (long k = -d; k <= d; k += 2) {
+      long x = (k == -d || (k != d && v[offset + k - 1] < v[offset + k + 1]))
+                   ? v[offset + k + 1]
+                   : v[offset + k - 1] + 1;
+      long y = x - k;
+      while (x < n && y < m && equal(x, y)) {
+        x++;
+        y++;
+      }
+      v[offset + k] = x;
+      if (x < n || y < m)
+        continue;
+      // walk the trace back from (n, m)
+      std::vector<std::pair<long, long>> path{{n, m}};
+      for (long e = d; e > 0; e--) {
+        const std::vector<long>& pv = trace[e];
+        // pv holds v[-e - 1 .. e + 1] from before step e
+        auto at = [&pv, e](long kk) { return pv[kk + e + 1]; };
+        long pk =
+            (k == -e || (k != e && at(k - 1) < at(k + 1))) ? k + 1 : k - 1;
+        long px = at(pk);
+        long py = px - pk;
+        path.push_back({px, py});
+        k = pk;
+      }
+      path.push_back({0, 0});
+      std::reverse(path.begin(), path.end());
+      return path;
+    }
+  }
+  return {};
+}
+}  // namespace
+
+bool LineDiff::diffFile(const EditBuffer& buf,
+                        const std::string& filename,
+                        std::vector<RowSplice>& splices) {
+  int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+  struct stat st {};
+  if (fd < 0 || fstat(fd, &st) < 0) {
+    if (fd >= 0)
+      close(fd);
+    return false;
+  }
+  std::string contents(st.st_size, '\0');
+  size_t size = 0;
+  while (size < contents.size()) {
+    ssize_t bytesRead = read(fd, &contents[size], contents.size() - size);
+    if (bytesRead <= 0)
+      break;
+    size += bytesRead;
+  }
+  close(fd);
+  contents.resize(size);
+  std::vector<Row> rows = hashRows(contents);
+  std::vector<size_t> hashes = hashLines(buf.lines);
+  auto isEqual = [&](size_t line, size_t row) {
+    return hashes[line] == rows[row].hash &&
+           buf.lines[line].size() == rows[row].size &&
+           memcmp(buf.lines[line].data(), contents.data() + rows[row].offset,
+                  rows[row].size) == 0;
+  };
+  auto getRow = [&](size_t row) {
+    return contents.substr(rows[row].offset, rows[row].size);
+  };
+  // most reloads only touch a few rows in the middle
+  size_t head = 0;
+  while (head < hashes.size() && head < rows.size() && isEqual(head, head))
+    head++;
+  size_t tail = 0;
+  while (tail < hashes.size() - head && tail < rows.size() - head &&
+         isEqual(hashes.size() - 1 - tail, rows.size() - 1 - tail))
+    tail++;
+  long n = hashes.size() - head - tail;
+  long m = rows.size() - head - tail;
+  splices.clear();
+  if (n == 0 && m == 0)
+    return true;
+  std::vector<std::pair<long, long>> path = getMyersPath(
+      n, m, [&](long x, long y) { return isEqual(head + x, head + y); });
+  if (path.size() == 0) {
+    // too different to be worth diffing further
+    RowSplice splice{head, (size_t)n, {}};
+    for (long y = 0; y < m; y++) {
+      splice.rows.push_back(getRow(head + y));
+    }
+    splices.push_back(std::move(splice));
+    return true;
+  }
+  // join the single row steps of the path into splices
+  for (size_t i = 1; i < path.size(); i++) {
+    long x = path[i - 1].first;
+    long y = path[i - 1].second;
+    long nextX = path[i].first;
+    long nextY = path[i].second;
+    // a step is one removal or insertion followed by a run of equal rows
+    if (nextX - x > nextY - y) {
+      if (splices.size() > 0 && splices.back().row + splices.back().removed ==
+                                    head + x)
+        splices.back().removed++;
+      else
+        splices.push_back(RowSplice{head + x, 1, {}});
+    } else if (nextY - y > nextX - x) {
+      if (splices.size() == 0 ||
+          splices.back().row + splices.back().removed != head + x)
+        splices.push_back(RowSplice{head + x, 0, {}});
+      splices.back().rows.push_back(getRow(head + y));
+    }
+  }
+  return true;
+}
@@ -0,0 +1,46 @@
+#include <algorithm>
+#include "pane.hh"
+
+void LineIndex::bufferLoaded(const EditBuffer& buf, const std::string&) {
+  std::vector<size_t> rowLengths{};
+  rowLengths.reserve(buf.lines.size());
+  for (const std::string& line : buf.lines) {
+    rowLengths.push_back(line.size() + 1);
+  }
+  lengths.assign(std::move(rowLengths));
+}
+void LineIndex::linesChanged(const EditBuffer& buf,
+                             size_t row,
+                             size_t removed,
+                             size_t inserted) {
+  if (removed != inserted)
+    lengths.splice(row, removed, inserted);
+  for (size_t i = row; i < row + inserted; i++) {
+    lengths.set(i, buf.lines[i].size() + 1);
+  }
+}
+void LineIndex::linesRotated(const EditBuffer& buf,
+                             size_t first,
+                             size_t,
+                             size_t last) {
+  for (size_t i = first; i < last; i++) {
+    lengths.set(i, buf.lines[i].size() + 1);
+  }
+}
+size_t LineIndex::getRowOffset(size_t row) {
+  return lengths.getSum(row);
+}
+BufferPosition LineIndex::getPosition(size_t offset) {
+  size_t row = lengths.find(offset);
+  if (row >= lengths.size()) {
+    if (lengths.size() == 0)
+      return BufferPosition{};
+    // past the end
+    return BufferPosition{lengths.size() - 1, lengths.get(row - 1) - 1};
+  }
+  return BufferPosition{row, offset};
+}
+size_t LineIndex::getByteCount() {
+  // no newline after the last row
+  return lengths.size() > 0 ? getRowOffset(lengths.size()) - 1 : 0;
+}
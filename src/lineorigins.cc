@@ -0,0 +1,77 @@
+#include <algorithm>
+#include "pane.hh"
+
+void LineOrigins::bufferLoaded(const EditBuffer& buf,
+                               const std::string& filename) {
+  this->filename = filename;
+  offsets.clear();
+  setOffsets(buf, offsets);
+  stamp();
+}
+void LineOrigins::linesChanged(const EditBuffer&,
+                               size_t row,
+                               size_t removed,
+                               size_t inserted) {
+  for (std::vector<long long>* rows : {&offsets, &pendingOffsets}) {
+    if (rows == &pendingOffsets && !isSaving)
+      continue;
+    spliceRowValues(*rows, row, removed, inserted, -1LL);
+  }
+}
+void LineOrigins::linesRotated(const EditBuffer&,
+                               size_t first,
+                               size_t middle,
+                               size_t last) {
+  // moved rows are still unchanged
+  for (std::vector<long long>* rows : {&offsets, &pendingOffsets}) {
+    if (rows == &pendingOffsets && !isSaving)
+      continue;
+    std::rotate(rows->begin() + first, rows->begin() + middle,
+                rows->begin() + last);
+  }
+}
+void LineOrigins::beginSave(const EditBuffer& buf) {
+  isSaving = true;
+  pendingOffsets.clear();
+  setOffsets(buf, pendingOffsets);
+}
+void LineOrigins::endSave(const std::string& filename, bool isSaved) {
+  isSaving = false;
+  if (isSaved) {
+    this->filename = filename;
+    offsets.swap(pendingOffsets);
+    stamp();
+  }
+  std::vector<long long>().swap(pendingOffsets);
+}
+bool LineOrigins::isSource(const struct stat& st) const {
+  return filename.size() > 0 && (long long)st.st_dev == device &&
+         (long long)st.st_ino == inode && (long long)st.st_size == size &&
+         getMtime(st) == mtime;
+}
+
+long long LineOrigins::getMtime(const struct stat& st) {
+  return st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+}
+void LineOrigins::setOffsets(const EditBuffer& buf,
+                             std::vector<long long>& rows) {
+  long long offset = 0;
+  rows.reserve(buf.lines.size());
+  for (const std::string& line : buf.lines) {
+    rows.push_back(offset);
+    offset += line.size() + 1;
+  }
+}
+void LineOrigins::stamp() {
+  struct stat st {};
+  if (stat(filename.c_str(), &st) < 0) {
+    // nothing to copy from
+    std::fill(offsets.begin(), offsets.end(), -1);
+    device = -1;
+    return;
+  }
+  device = st.st_dev;
+  inode = st.st_ino;
+  size = st.st_size;
+  mtime = getMtime(st);
+}
@@ -0,0 +1,154 @@
+#include <algorithm>
+#include <iostream>
+#include <iterator>
+#include "const.hh"
+#include "pane.hh"
+
+bool Macro::isRecording() const {
+  return isRecordingKeys;
+}
+void Macro::startRecording() {
+  isRecordingKeys = true;
+  keys.clear();
+}
+void Macro::stopRecording() {
+  isRecordingKeys = false;
+}
+void Macro::record(int keycode) {
+  // prompts, tabs and history can't be replayed against the text
+  switch (keycode) {
+    case CTRL_S:
+    case CTRL_O:
+    case CTRL_D:
+    case CTRL_P:
+    case CTRL_R:
+    case CTRL_W:
+    case CTRL_Z:
+    case CTRL_Y:
+    case CTRL_PAGE_UP:
+    case CTRL_PAGE_DOWN:
+    case RESIZE:
+      return;
+  }
+  keys.push_back(keycode);
+}
+const std::vector<int>& Macro::getKeys() const {
+  return keys;
+}
+bool Macro::isGrouping() const {
+  return isGroupingRows;
+}
+void Macro::beginGroup() {
+  isGroupingRows = true;
+  runs.clear();
+}
+void Macro::endGroup(const EditBuffer& buf,
+                     std::vector<RowSplice>& splices,
+                     std::vector<RowSplice>& reverts) {
+  // splices turn the rows from before into the rows now, reverts the reverse.
+  // a run starts as many rows above where it started as the runs above it grew
+  splices.clear();
+  reverts.clear();
+  long long grown = 0;
+  for (ChangedRun& run : runs) {
+    auto rows = buf.lines.begin() + run.row;
+    long long runGrowth = (long long)run.count - (long long)run.before.size();
+    if (run.count == run.before.size() &&
+        std::equal(run.before.begin(), run.before.end(), rows)) {
+      continue;
+    }
+    splices.push_back(RowSplice{run.row - grown, run.before.size(),
+                                {rows, rows + run.count}});
+    reverts.push_back(RowSplice{run.row, run.count, std::move(run.before)});
+    grown += runGrowth;
+  }
+  isGroupingRows = false;
+  std::vector<ChangedRun>().swap(runs);
+}
+void Macro::linesWillChange(const EditBuffer& buf, size_t row, size_t count) {
+  touch(row, row + count,
+        [&buf](size_t i) -> const std::string& { return buf.lines[i]; });
+}
+void Macro::linesChanged(const EditBuffer&,
+                         size_t row,
+                         size_t removed,
+                         size_t inserted) {
+  // linesWillChange made a run covering the removed rows
+  auto run = findRun(row);
+  if (run == runs.end() || run->row > row ||
+      run->row + run->count < row + removed) {
+    std::cout << "ERROR:Macro::linesChanged untouched rows " << row
+              << std::endl;
+    return;
+  }
+  run->count = run->count - removed + inserted;
+  for (run++; run != runs.end(); run++) {
+    run->row = run->row - removed + inserted;
+  }
+}
+void Macro::linesRotated(const EditBuffer& buf,
+                         size_t first,
+                         size_t middle,
+                         size_t last) {
+  // notified after the rows moved, so the rows from before are found where
+  // they went
+  touch(first, last,
+        [&buf, first, middle, last](size_t i) -> const std::string& {
+          if (i < first || i >= last)
+            return buf.lines[i];
+          if (i >= middle)
+            return buf.lines[first + (i - middle)];
+          return buf.lines[first + (last - middle) + (i - first)];
+        });
+}
+void Macro::rowsReplaced(const EditBuffer& buf,
+                         const std::vector<std::vector<RowChange>>& shards) {
+  for (const std::vector<RowChange>& changes : shards) {
+    for (const RowChange& change : changes) {
+      touch(change.row, change.row + 1,
+            [&buf, &change](size_t i) -> const std::string& {
+              return i == change.row ? change.text : buf.lines[i];
+            });
+    }
+  }
+}
+
+std::vector<Macro::ChangedRun>::iterator Macro::findRun(size_t row) {
+  // the first run ending at or after row
+  return std::lower_bound(runs.begin(), runs.end(), row,
+                          [](const ChangedRun& run, size_t row) {
+                            return run.row + run.count < row;
+                          });
+}
+template <typename F>
+void Macro::touch(size_t first, size_t last, F getBefore) {
+  // rows [first, last) join the run they overlap or border, merging any runs
+  // they bridge. rows not yet in a run are unchanged, so are copied as they are
+  auto begin = findRun(first);
+  auto end = begin;
+  while (end != runs.end() && end->row <= last) {
+    end++;
+  }
+  ChangedRun merged{first, 0, {}};
+  size_t mergedEnd = last;
+  if (begin != end) {
+    merged.row = std::min(first, begin->row);
+    mergedEnd = std::max(last, (end - 1)->row + (end - 1)->count);
+  }
+  size_t row = merged.row;
+  for (auto run = begin; run != end; run++) {
+    for (; row < run->row; row++) {
+      merged.before.push_back(getBefore(row));
+    }
+    std::move(run->before.begin(), run->before.end(),
+              std::back_inserter(merged.before));
+    row = run->row + run->count;
+  }
+  for (; row < mergedEnd; row++) {
+    merged.before.push_back(getBefore(row));
+  }
+  merged.count = mergedEnd - merged.row;
+  size_t index = begin - runs.begin();
+  runs.erase(begin, end);
+  runs.insert(runs.begin() + index, std::move(merged));
+}
@@ -0,0 +1,88 @@
+#include <malloc.h>
+#include <algorithm>
+#include <atomic>
+#include "pane.hh"
+
+namespace {
+std::atomic<long long> usageBytes[MS_COUNT]{};
+std::atomic<long long> usageAllocations[MS_COUNT]{};
+std::atomic<long long> usageOverhead[MS_COUNT]{};
+const char* SUBSYSTEM_NAMES[MS_COUNT]{"lines",     "undo",  "search",
+                                      "clipboard", "words", "snapshots"};
+}  // namespace
+
+void MemoryStats::add(MemorySubsystem subsystem,
+                      long long bytes,
+                      long long allocations,
+                      long long overhead) {
+  usageBytes[subsystem] += bytes;
+  usageAllocations[subsystem] += allocations;
+  usageOverhead[subsystem] += overhead;
+}
+long long MemoryStats::addString(MemorySubsystem subsystem,
+                                 const std::string& str,
+                                 int sign) {
+  // short strings live inside the std::string itself. a string's capacity
+  // can't be used here: moving strings around a vector trades their buffers
+  // between rows we weren't told about
+  static const size_t inlineCapacity = std::string{}.capacity();
+  if (str.size() <= inlineCapacity)
+    return 0;
+  long long bytes = str.size() + 1;
+  add(subsystem, sign * bytes, sign, sign * getMallocOverhead(bytes));
+  return sign * bytes;
+}
+long long MemoryStats::getMallocOverhead(long long bytes) {
+  // glibc chunks carry a size word and are 16 byte aligned, 32 at minimum
+  long long chunk = (bytes + sizeof(size_t) + 15) & ~15LL;
+  return std::max(chunk, 32LL) - bytes;
+}
+MemoryUsage MemoryStats::get(MemorySubsystem subsystem) {
+  return MemoryUsage{usageBytes[subsystem], usageAllocations[subsystem],
+                     usageOverhead[subsystem]};
+}
+std::string MemoryStats::formatSummary() {
+  std::string summary{};
+  for (int i = 0; i < MS_COUNT; i++) {
+    if (i > 0)
+      summary.append(" ");
+    summary.append(SUBSYSTEM_NAMES[i]);
+    summary.append(" ");
+    summary.append(formatBytes(usageBytes[i]));
+  }
+  return summary;
+}
+std::string MemoryStats::formatReport() {
+  std::string report{};
+  long long accounted = 0;
+  for (int i = 0; i < MS_COUNT; i++) {
+    MemoryUsage usage = get((MemorySubsystem)i);
+    accounted += usage.bytes + usage.overhead;
+    char entry[128];
+    std::snprintf(entry, sizeof(entry), "%s %s in %lld allocs (+%s), ",
+                  SUBSYSTEM_NAMES[i], formatBytes(usage.bytes).c_str(),
+                  usage.allocations, formatBytes(usage.overhead).c_str());
+    report.append(entry);
+  }
+  struct mallinfo2 info = mallinfo2();
+  long long heap = info.uordblks + info.hblkhd;
+  report.append("heap " + formatBytes(heap) + ", other " +
+                formatBytes(heap - accounted));
+  return report;
+}
+std::string MemoryStats::formatBytes(long long bytes) {
+  const char* units = "BKMGT";
+  double value = bytes;
+  int unit = 0;
+  while ((value >= 1024 || value <= -1024) && unit < 4) {
+    value /= 1024;
+    unit++;
+  }
+  char formatted[32];
+  if (unit == 0) {
+    std::snprintf(formatted, sizeof(formatted), "%lldB", bytes);
+  } else {
+    std::snprintf(formatted, sizeof(formatted), "%.1f%c", value, units[unit]);
+  }
+  return formatted;
+}
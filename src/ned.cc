@@ -3,6 +3,8 @@
 #include <unistd.h>
 #include <fstream>
 #include <iostream>
+#include <memory>
+#include <vector>
 #include "const.hh"
 #include "pane.hh"
 //hello world
@@ -24,17 +26,97 @@ std::string toDirectory(std::string filepath) {
   return filepath;
 }
 
-void mainLoop(Pane& pane) {
+// a pane and the window it draws into
+struct View {
+  WINDOW* window{};
+  std::unique_ptr<Pane> pane{};
+};
+
+WINDOW* newPaneWindow() {
+  WINDOW* window = newwin(0, 0, 0, 0);
+  keypad(window, true);
+  intrflush(window, false);
+  // raw() undoes halfdelay, and the panes tick while no key is pressed
+  wtimeout(window, 100);
+  return window;
+}
+
+// side by side, splitting the width of the terminal
+void layoutViews(std::vector<View>& views) {
+  int width = COLS / views.size();
+  for (size_t i = 0; i < views.size(); i++) {
+    int x = i * width;
+    int viewWidth = i + 1 < views.size() ? width : COLS - x;
+    // shrunk first so the move always fits on the screen
+    wresize(views[i].window, 1, 1);
+    mvwin(views[i].window, 0, x);
+    wresize(views[i].window, LINES, viewWidth);
+  }
+}
+
+void redrawViews(std::vector<View>& views) {
+  for (View& view : views) {
+    view.pane->redraw();
+  }
+}
+
+// a second pane on the tab of the focused one, or back to the focused one
+void toggleSplit(std::vector<View>& views, size_t& focus) {
+  if (views.size() == 1) {
+    WINDOW* window = newPaneWindow();
+    views.push_back(
+        View{window, std::make_unique<Pane>(window, *views[focus].pane)});
+    views.back().pane->setFocused(false);
+  } else {
+    View focused = std::move(views[focus]);
+    for (size_t i = 0; i < views.size(); i++) {
+      if (i == focus)
+        continue;
+      views[i].pane.reset();
+      delwin(views[i].window);
+    }
+    views.clear();
+    views.push_back(std::move(focused));
+    focus = 0;
+  }
+  layoutViews(views);
+  redrawViews(views);
+}
+
+void mainLoop(std::vector<View>& views, size_t& focus) {
+  for (View& view : views) {
+    view.pane->tick();
+  }
+  Pane& pane = *views[focus].pane;
   int keycode = pane.getKeypress();
-  std::cout << "key: " << keycode << std::endl;
+  // the 100ms timeout returns -1 whenever no key was pressed
   if (keycode == -1) {
     return;
   }
+  std::cout << "key: " << keycode << std::endl;
   if (keycode == CTRL_C || keycode == CTRL_Q) {
     quitNed = true;
     return;
   }
+  if (keycode == CTRL_T) {
+    toggleSplit(views, focus);
+    return;
+  }
+  if (keycode == CTRL_G) {
+    pane.setFocused(false);
+    focus = (focus + 1) % views.size();
+    views[focus].pane->setFocused(true);
+    redrawViews(views);
+    return;
+  }
+  if (keycode == RESIZE)
+    layoutViews(views);
   pane.handleKeypress(keycode);
+  // the other panes may show the rows that just changed
+  for (View& view : views) {
+    if (view.pane.get() != &pane)
+      view.pane->redraw();
+  }
 }
 
 #define RGB_TUPLE(HEX) (HEX >> 16) & (0xFF), (HEX >> 8) & (0xFF), (HEX & 0xFF)
@@ -63,6 +145,13 @@ void setupColors() {
   init_pair(N_INFO, darkgray, lightwhite);
   init_pair(N_COMMAND, 15, darkgray);
   init_pair(N_HIGHLIGHT, 15, 39);
+  init_pair(N_KEYWORD, 111, darkgray);
+  init_pair(N_COMMENT, 246, darkgray);
+  init_pair(N_STRING, 180, darkgray);
+  init_pair(N_NUMBER, 141, darkgray);
+  init_pair(N_PREPROC, 174, darkgray);
+  init_pair(N_ERROR, lightwhite, 160);
+  init_pair(N_WARNING, darkgray, 178);
 }
 #undef RGB_TUPLE
 
@@ -75,30 +164,39 @@ int main(int argc, char** argv) {
   std::cout.rdbuf(logfile.rdbuf());
 
   signal(SIGINT, exitNed);
+  // a filter command that stops reading is an error on write, not an exit
+  signal(SIGPIPE, SIG_IGN);
 
   // setup ncurses
   initscr();
   setupColors();
-  WINDOW* textPane = newwin(0, 0, 0, 0);
   std::cout << "LINES=" << LINES << std::endl;
   std::cout << "COLS=" << COLS << std::endl;
-  keypad(textPane, true);
-  intrflush(textPane, false);
   halfdelay(1);
   noecho();
   nonl();
   curs_set(0);
   raw();
 
-  Pane pane{textPane};
-  if (argc == 2) {
-    pane.loadFromFile(argv[1]);
+  // files are only read once their tab is shown
+  BufferManager buffers{MEMORY_BUDGET};
+  for (int i = 1; i < argc; i++) {
+    buffers.openTab(argv[i]);
   }
-  pane.redraw();
+  Clipboard clipboard{};
+  std::vector<View> views{};
+  WINDOW* textPane = newPaneWindow();
+  views.push_back(
+      View{textPane, std::make_unique<Pane>(textPane, buffers, clipboard)});
+  size_t focus = 0;
+  views[0].pane->redraw();
 
   // MAIN LOOP
   while (!quitNed) {
-    mainLoop(pane);
+    mainLoop(views, focus);
+  }
+  for (View& view : views) {
+    view.pane->shutdown();
   }
 
   exitNed(0);
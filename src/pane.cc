@@ -1,9 +1,12 @@
 #include "pane.hh"
 #include <assert.h>
+#include <ctype.h>
 #include <ncurses.h>
+#include <chrono>
 #include <fstream>
 #include <iostream>
 #include <memory>
+#include <sstream>
 #include "const.hh"
 
 int getNumDigits(int num) {
@@ -21,9 +24,44 @@ int getNumDigits(int num) {
 }
 
 enum PaneFocus { PF_TEXT, PF_COMMAND };
-enum Command { OPEN, SAVE, FIND };
+enum Command { OPEN, SAVE, FIND, EXECUTE };
 
-Pane::Pane(WINDOW* window) : paneFocus{PF_TEXT}, window{window} {}
+Pane::Pane(WINDOW* window, BufferManager& buffers, Clipboard& clipboard)
+    : paneFocus{PF_TEXT},
+      window{window},
+      buffers{buffers},
+      clipboard{clipboard} {
+  if (buffers.size() == 0)
+    buffers.openTab("");
+  showTab(buffers.getActiveIndex());
+}
+Pane::Pane(WINDOW* window, const Pane& other)
+    : paneFocus{PF_TEXT},
+      window{window},
+      buffers{other.buffers},
+      clipboard{other.clipboard} {
+  showTab(buffers.indexOf(other.tab));
+  cursors = other.cursors;
+  bufOffset = other.bufOffset;
+  if (other.isWrapped)
+    setWrapped(true);
+  offsetSegment = other.offsetSegment;
+}
+Pane::~Pane() {
+  filter.stop();
+  if (filteringTab != nullptr)
+    filteringTab->isFiltering = false;
+  if (savingTab != nullptr)
+    finishSave();
+  if (tab != nullptr) {
+    tab->cursors = cursors;
+    tab->bufOffset = bufOffset;
+    tab->buf.removeObserver(&highlighter);
+    tab->buf.removeObserver(&wrapIndex);
+    tab->buf.removeObserver(&anchor);
+    tab->viewCount--;
+  }
+}
 
 void Pane::addCursor() {
   cursors.push_back(BufferCursor{});
@@ -44,11 +82,196 @@ void Pane::handleKeypress(int keycode) {
   }
 }
 void Pane::loadFromFile(const std::string& iFilename) {
-  buf.loadFromFile(iFilename);
-  filename = iFilename;
+  size_t index = buffers.openTab(iFilename);
+  if (tab->filename.size() == 0 && !tab->isModified() &&
+      tab->buf.lines.size() == 0) {
+    // replace an untouched new file instead of keeping it open next to this one
+    BufferTab* untitled = tab;
+    showTab(index);
+    // unless another pane still shows it or works on it
+    if (untitled->viewCount == 0 && !untitled->isSaving &&
+        !untitled->isFiltering)
+      buffers.closeTab(buffers.indexOf(untitled));
+    return;
+  }
+  showTab(index);
+}
+void Pane::showTab(size_t index) {
+  if (tab != nullptr) {
+    tab->cursors = cursors;
+    tab->bufOffset = bufOffset;
+    tab->buf.removeObserver(&highlighter);
+    tab->buf.removeObserver(&wrapIndex);
+    tab->buf.removeObserver(&anchor);
+    tab->viewCount--;
+  }
+  tab = buffers.activateTab(index);
+  tab->viewCount++;
+  if (tab->recoveredCount > 0) {
+    commandPrompt = "Recovered " + std::to_string(tab->recoveredCount) +
+                    " unsaved edits from the journal";
+    tab->recoveredCount = 0;
+  }
+  cursors = tab->cursors;
+  bufOffset = tab->bufOffset;
+  offsetSegment = 0;
+  setSearchResults({});
+  searchResults.isValid = false;
+  tab->buf.addObserver(&highlighter);
+  tab->buf.addObserver(&anchor);
+  highlighter.setLanguage(tab->filename);
+  if (isWrapped) {
+    tab->buf.addObserver(&wrapIndex);
+    wrapIndex.reset(tab->buf, getWrapWidth());
+  }
+  changeWatcher.watch(tab->filename);
+  // the file may have changed while another tab was shown
+  if (tab->hasDiskEvent)
+    checkDiskChanges();
+}
+void Pane::setFocused(bool focused) {
+  isFocused = focused;
+  // only the focused pane edits, so the others follow its edits
+  anchor.isEnabled = !focused;
+  if (focused)
+    buffers.activateTab(buffers.indexOf(tab));
+}
+void Pane::tick() {
+  if (memoryDumpInterval > 0) {
+    long long now = std::chrono::duration_cast<std::chrono::seconds>(
+                        std::chrono::steady_clock::now().time_since_epoch())
+                        .count();
+    if (now - lastMemoryDump >= memoryDumpInterval) {
+      std::cout << "memory: " << MemoryStats::formatReport() << std::endl;
+      lastMemoryDump = now;
+    }
+  }
+  if (tab->follower.isFollowing()) {
+    // stay at the bottom unless the user moved away from it
+    bool isAtEnd = getLeadCursor().getRow() + 1 >= tab->buf.lines.size();
+    if (tab->follower.poll(tab->buf)) {
+      if (isAtEnd) {
+        cursors = {BufferCursor{}};
+        cursors[0].moveSet(0, tab->buf.lines.size() - 1);
+      }
+      redraw();
+    }
+  }
+  if (savingTab != nullptr) {
+    if (saver.isDone())
+      finishSave();
+    // progress, or the result once done
+    redraw();
+  }
+  std::vector<std::string> changedPaths = changeWatcher.poll();
+  for (const std::string& path : changedPaths) {
+    for (size_t i = 0; i < buffers.size(); i++) {
+      BufferTab* changedTab = buffers.getTab(i);
+      if (changedTab->filename.size() > 0 &&
+          ChangeWatcher::getPath(changedTab->filename) == path)
+        changedTab->hasDiskEvent = true;
+    }
+  }
+  if (builder.isRunning() && builder.poll())
+    redraw();
+  if (projectSearch.isRunning()) {
+    // the results tab may have been closed in another pane
+    if (buffers.indexOf(searchTab) >= buffers.size())
+      projectSearch.stop();
+    else if (projectSearch.poll(searchTab->buf))
+      redraw();
+  }
+  if (filteringTab != nullptr && filter.isDone()) {
+    finishFilter();
+    redraw();
+  }
+  if (tab->hasDiskEvent && !tab->isSaving) {
+    checkDiskChanges();
+    redraw();
+  }
+}
+void Pane::checkDiskChanges() {
+  struct stat st {};
+  if (stat(tab->filename.c_str(), &st) < 0 || !tab->isDiskChanged(st) ||
+      tab->follower.isFollowing()) {
+    // our own save, or the follower already reads what was written
+    tab->hasDiskEvent = false;
+    return;
+  }
+  if (tab->isModified()) {
+    // reloading would replace the edits, so leave it to the user
+    tab->hasDiskEvent = false;
+    commandPrompt = tab->filename + " changed on disk, run reload to load it";
+    return;
+  }
+  reloadFromDisk();
+}
+void Pane::reloadFromDisk() {
+  tab->hasDiskEvent = false;
+  struct stat st {};
+  stat(tab->filename.c_str(), &st);
+  std::vector<RowSplice> splices{};
+  if (!LineDiff::diffFile(tab->buf, tab->filename, splices)) {
+    commandPrompt = "Can't read " + tab->filename;
+    return;
+  }
+  if (splices.size() > 0) {
+    // keep cursors on the rows they were on, or where those rows were removed
+    auto mapRow = [&splices](size_t row) {
+      long shift = 0;
+      for (const RowSplice& splice : splices) {
+        if (row < splice.row)
+          break;
+        if (row < splice.row + splice.removed)
+          return splice.row + shift;
+        shift += (long)splice.rows.size() - (long)splice.removed;
+      }
+      return row + shift;
+    };
+    std::vector<BufferCursor> mappedCursors{};
+    for (const BufferCursor& cursor : cursors) {
+      mappedCursors.emplace_back();
+      mappedCursors.back().moveSet(cursor.getCol(), mapRow(cursor.getRow()));
+    }
+    bufOffset.row = mapRow(bufOffset.row);
+    BufferOperation bufOp = tab->buf.spliceRows(splices);
+    saveBufOp(bufOp);
+    size_t lastRow = tab->buf.lines.size() > 0 ? tab->buf.lines.size() - 1 : 0;
+    for (BufferCursor& cursor : mappedCursors) {
+      if (cursor.getRow() > lastRow)
+        cursor.moveSet(0, lastRow);
+    }
+    cursors = mappedCursors;
+  }
+  // what's on disk is the saved state now, and the journal starts from it
+  tab->savedOpStackPosition = tab->opStackPosition;
+  tab->origins.bufferLoaded(tab->buf, tab->filename);
+  tab->stampDisk(st);
+  tab->rebaseJournal();
+  tab->loadError = "";
+  commandPrompt = "Reloaded " + tab->filename + ": " +
+                  std::to_string(splices.size()) + " changes";
+}
+void Pane::shutdown() {
+  builder.stop();
+  filter.stop();
+  projectSearch.stop();
+  if (savingTab != nullptr)
+    finishSave();
+  // journals only outlive a crash
+  for (size_t i = 0; i < buffers.size(); i++) {
+    buffers.getTab(i)->journal.remove();
+  }
 }
 void Pane::redraw() {
+  // the width changes with the terminal and the gutter
+  if (isWrapped)
+    wrapIndex.setWidth(tab->buf, getWrapWidth());
   adjustOffset();
+  updateBracketPair();
+  int maxY = getmaxy(window);
+  // lex a screen ahead so scrolling down rarely has to wait on the lexer
+  highlighter.update(tab->buf, bufOffset.row + 2 * maxY);
   std::cout << "bufOffset{row,col}: {" << bufOffset.row << ", " << bufOffset.col
             << "}" << std::endl;
   drawBuffer();
@@ -60,8 +283,8 @@ void Pane::initiateSaveCommand() {
   paneFocus = PF_COMMAND;
   command = SAVE;
   commandPrompt = "Save Filename: ";
-  userCommandArgs = filename;
-  commandCursorPosition = filename.size();
+  userCommandArgs = tab->filename;
+  commandCursorPosition = tab->filename.size();
   redraw();
 }
 void Pane::initiateOpenCommand() {
@@ -80,20 +303,380 @@ void Pane::initiateFindCommand() {
   commandCursorPosition = 0;
   redraw();
 }
-void Pane::saveBufferToFile(const std::string& saveTarget) const {
-  std::ofstream saveFile{"ned.tmp", std::ios_base::trunc | std::ios_base::out};
-  for (size_t line = 0; line < buf.lines.size(); line++) {
-    for (size_t col = 0; col < buf.lines[line].size(); col++) {
-      saveFile.put(buf.lines[line][col]);
+void Pane::initiateExecuteCommand() {
+  paneFocus = PF_COMMAND;
+  command = EXECUTE;
+  commandPrompt = "Command: ";
+  userCommandArgs = "";
+  commandCursorPosition = 0;
+  redraw();
+}
+void Pane::runCommand(const std::string& commandLine) {
+  std::istringstream args{commandLine};
+  std::string name{};
+  args >> name;
+  if (name == "mem") {
+    isMemoryShown = !isMemoryShown;
+    commandPrompt = MemoryStats::formatReport();
+  } else if (name == "memdump") {
+    memoryDumpInterval = 0;
+    args >> memoryDumpInterval;
+    lastMemoryDump = 0;
+    commandPrompt = memoryDumpInterval > 0
+                        ? "Dumping memory to log every " +
+                              std::to_string(memoryDumpInterval) + "s"
+                        : "Stopped memory dumps";
+  } else if (name == "goto" || name == "byte") {
+    size_t target = 0;
+    args >> target;
+    BufferPosition position{};
+    if (name == "byte") {
+      position = tab->lineIndex.getPosition(target);
+    } else if (tab->buf.lines.size() > 0) {
+      // lines are numbered from 1, like the gutter
+      position.row = std::min(target > 0 ? target - 1 : 0,
+                              tab->buf.lines.size() - 1);
+    }
+    cursors = {BufferCursor{}};
+    cursors[0].moveSet(position.col, position.row);
+    commandPrompt = "";
+  } else if (name == "follow") {
+    if (tab->follower.isFollowing()) {
+      tab->follower.stop();
+      commandPrompt = "Stopped following " + tab->filename;
+    } else if (tab->follower.start(tab->filename, tab->diskSize)) {
+      commandPrompt = "Following " + tab->filename;
+    } else {
+      commandPrompt = "Can't follow " + tab->filename;
+    }
+  } else if (name == "replace") {
+    // replace /query/replacement/, with any delimiter the query doesn't use
+    std::string rest{};
+    std::getline(args >> std::ws, rest);
+    size_t middle = rest.size() > 0 ? rest.find(rest[0], 1) : std::string::npos;
+    if (middle == std::string::npos || middle == 1) {
+      commandPrompt = "Usage: replace /query/replacement/";
+      return;
     }
-    if (line < buf.lines.size() - 1) {
-      saveFile.put('\n');
+    size_t end = rest.find(rest[0], middle + 1);
+    std::string query = rest.substr(1, middle - 1);
+    std::string replacement = rest.substr(middle + 1, end - middle - 1);
+    size_t count = 0;
+    BufferOperation bufOp =
+        tab->buf.replaceAll(cursors, query, replacement, count);
+    if (count > 0)
+      saveBufOp(bufOp);
+    setSearchResults({});
+    searchResults.isValid = false;
+    commandPrompt = "Replaced " + std::to_string(count) + " occurrences";
+  } else if (name == "sort" || name == "unique" || name == "reverse") {
+    // the rows the selections span, or every row
+    size_t rowCount = tab->buf.lines.size();
+    size_t count = 0;
+    BufferOperation bufOp = tab->buf.reorderRows(cursors, name, count);
+    if (count > 0)
+      saveBufOp(bufOp);
+    setSearchResults({});
+    searchResults.isValid = false;
+    if (name == "unique")
+      commandPrompt = "Removed " +
+                      std::to_string(rowCount - tab->buf.lines.size()) +
+                      " duplicates of " + std::to_string(count) + " rows";
+    else
+      commandPrompt = (name == "sort" ? "Sorted " : "Reversed ") +
+                      std::to_string(count) + " rows";
+  } else if (name == "filter") {
+    std::string filterCommand{};
+    std::getline(args >> std::ws, filterCommand);
+    if (filterCommand == "stop") {
+      filter.stop();
+      if (filteringTab != nullptr)
+        filteringTab->isFiltering = false;
+      filteringTab = nullptr;
+      commandPrompt = "Stopped the filter";
+    } else if (filterCommand.size() == 0) {
+      commandPrompt = "Usage: filter COMMAND";
+    } else {
+      startFilter(filterCommand);
+    }
+  } else if (name == "grep") {
+    // grep /query/ [directory], with any delimiter the query doesn't use
+    std::string rest{};
+    std::getline(args >> std::ws, rest);
+    size_t end = rest.size() > 0 ? rest.find(rest[0], 1) : std::string::npos;
+    if (rest == "stop") {
+      projectSearch.stop();
+      commandPrompt = "Stopped the grep";
+    } else if (end == std::string::npos || end == 1) {
+      commandPrompt = "Usage: grep /query/ [directory]";
+    } else {
+      std::istringstream directoryArg{rest.substr(end + 1)};
+      std::string directory{"."};
+      directoryArg >> directory;
+      startProjectSearch(rest.substr(1, end - 1), directory);
+    }
+  } else if (name == "macro") {
+    // macro [COUNT | /query/] [each]: each keeps every step in the history
+    size_t count = 1;
+    std::string query{};
+    bool isGrouped = true;
+    std::string arg{};
+    while (args >> arg) {
+      if (arg == "each")
+        isGrouped = false;
+      else if (arg.size() > 2 && arg.front() == '/' && arg.back() == '/')
+        query = arg.substr(1, arg.size() - 2);
+      else
+        count = std::strtoul(arg.c_str(), nullptr, 10);
+    }
+    replayMacro(count, query, isGrouped);
+  } else if (name == "build") {
+    std::string buildCommand{};
+    std::getline(args >> std::ws, buildCommand);
+    if (buildCommand == "stop") {
+      builder.stop();
+      commandPrompt = "Stopped the build";
+    } else {
+      if (buildCommand.size() == 0)
+        buildCommand = "make";
+      commandPrompt = builder.start(buildCommand)
+                          ? "Building: " + buildCommand
+                          : "Can't start " + buildCommand;
+    }
+  } else if (name == "reload") {
+    if (tab->filename.size() == 0 || tab->isSaving)
+      commandPrompt = "Nothing to reload";
+    else
+      reloadFromDisk();
+  } else if (name == "fold") {
+    foldAtCursor();
+  } else if (name == "unfold") {
+    std::string arg{};
+    args >> arg;
+    if (arg == "all") {
+      tab->folds.clear();
+      commandPrompt = "Unfolded everything";
+    } else {
+      size_t hidden = tab->folds.unfold(getLeadCursor().getRow());
+      commandPrompt = hidden > 0
+                          ? "Unfolded " + std::to_string(hidden) + " rows"
+                          : "Nothing folded here";
+    }
+  } else if (name == "wrap") {
+    setWrapped(!isWrapped);
+    commandPrompt = isWrapped ? "Wrapping lines" : "Stopped wrapping lines";
+  } else if (name == "durability") {
+    const char* names[]{"none", "data", "full"};
+    std::string level{};
+    args >> level;
+    for (int i = SD_NONE; i <= SD_FULL; i++) {
+      if (level == names[i])
+        saveDurability = (SaveDurability)i;
     }
+    commandPrompt = std::string{"Save durability: "} + names[saveDurability];
+  } else {
+    commandPrompt = "Unknown command: " + name;
   }
-  saveFile.close();
-  std::rename(saveTarget.c_str(), "ned.tmp.bak");
-  std::rename("ned.tmp", saveTarget.c_str());
-  std::remove("ned.tmp.bak");
+}
+void Pane::replayMacro(size_t count,
+                       const std::string& query,
+                       bool isGrouped) {
+  if (macro.isRecording())
+    macro.stopRecording();
+  if (macro.getKeys().size() == 0) {
+    commandPrompt = "No macro recorded, ctrl-r to record one";
+    return;
+  }
+  std::vector<size_t> rows{};
+  if (query.size() > 0) {
+    // bottom-up, so edits don't move the rows still to come
+    for (size_t row = tab->buf.lines.size(); row-- > 0;) {
+      if (tab->buf.lines[row].find(query) != std::string::npos)
+        rows.push_back(row);
+    }
+    count = rows.size();
+  }
+  // an empty buffer has no rows to diff the result against
+  isGrouped = isGrouped && tab->buf.lines.size() > 0;
+  // the other observers keep up with every key, so moves that use them work
+  // mid-replay. the macro only notes which rows changed
+  if (isGrouped) {
+    macro.beginGroup();
+    tab->buf.addObserver(&macro);
+  }
+  isReplaying = true;
+  for (size_t i = 0; i < count; i++) {
+    if (query.size() > 0) {
+      cursors = {BufferCursor{}};
+      cursors[0].moveSet(0, rows[i]);
+    }
+    for (int keycode : macro.getKeys()) {
+      handleTextKeypress(keycode);
+    }
+  }
+  isReplaying = false;
+  if (isGrouped) {
+    std::vector<RowSplice> splices{};
+    std::vector<RowSplice> reverts{};
+    macro.endGroup(tab->buf, splices, reverts);
+    tab->buf.removeObserver(&macro);
+    // put the rows back and make the whole change again as one operation
+    tab->buf.spliceRows(reverts);
+    if (splices.size() > 0) {
+      std::vector<BufferCursor> replayCursors = cursors;
+      BufferOperation bufOp = tab->buf.spliceRows(splices);
+      saveBufOp(bufOp);
+      cursors = replayCursors;
+    }
+  }
+  commandPrompt = "Replayed " + std::to_string(count) + " times";
+}
+void Pane::closeTab() {
+  if (tab->isModified()) {
+    commandPrompt = "Unsaved changes, save before closing";
+    return;
+  }
+  // the save or filter may be another pane's
+  if (tab->isSaving) {
+    commandPrompt = "Still saving, close when it finishes";
+    return;
+  }
+  if (tab->isFiltering) {
+    commandPrompt = "Still filtering, close when it finishes";
+    return;
+  }
+  if (tab->viewCount > 1) {
+    commandPrompt = "Open in another pane, close it there";
+    return;
+  }
+  if (tab == searchTab) {
+    projectSearch.stop();
+    searchTab = nullptr;
+  }
+  size_t index = buffers.indexOf(tab);
+  tab->buf.removeObserver(&highlighter);
+  tab->buf.removeObserver(&wrapIndex);
+  tab->buf.removeObserver(&anchor);
+  tab = nullptr;
+  buffers.closeTab(index);
+  showTab(std::min(index, buffers.size() - 1));
+}
+void Pane::saveBufferToFile(const std::string& saveTarget) {
+  // the snapshot is what gets saved, so editing can go on meanwhile
+  savingTab = tab;
+  tab->isSaving = true;
+  tab->savingOpStackPosition = tab->opStackPosition;
+  saver.start(tab->versions.snapshot(tab->buf), tab->lineIndex.getByteCount(),
+              tab->origins, saveTarget, saveDurability);
+  tab->origins.beginSave(tab->buf);
+  saveStatus = "";
+}
+void Pane::finishSave() {
+  bool isSaved = saver.finish();
+  savingTab->origins.endSave(savingTab->filename, isSaved);
+  if (isSaved) {
+    savingTab->savedOpStackPosition = savingTab->savingOpStackPosition;
+    savingTab->rebaseJournal();
+    struct stat st {};
+    stat(savingTab->filename.c_str(), &st);
+    savingTab->stampDisk(st);
+    changeWatcher.watch(savingTab->filename);
+    savingTab->loadError = "";
+    saveStatus = "saved";
+  } else {
+    std::cout << "ERROR:saveBufferToFile " << saver.getError() << std::endl;
+    saveStatus = "save failed: " + saver.getError();
+  }
+  savingTab->savingOpStackPosition = -1;
+  savingTab->isSaving = false;
+  savingTab = nullptr;
+}
+void Pane::startFilter(const std::string& command) {
+  if (filteringTab != nullptr) {
+    commandPrompt = "Already filtering, run filter stop first";
+    return;
+  }
+  if (tab->isFiltering) {
+    commandPrompt = "Another pane is filtering this buffer";
+    return;
+  }
+  // the rows the selections span, or every row
+  size_t first = 0;
+  size_t count = 0;
+  tab->buf.getSelectedRows(cursors, first, count);
+  if (!filter.start(command, tab->versions.snapshot(tab->buf), first, count)) {
+    commandPrompt = "Can't start " + command;
+    return;
+  }
+  filteringTab = tab;
+  tab->isFiltering = true;
+  filterVersion = tab->versions.getVersion();
+  filterCursors = cursors;
+  commandPrompt = "Filtering " + std::to_string(count) + " rows through " +
+                  command;
+}
+void Pane::finishFilter() {
+  std::vector<std::string> rows{};
+  bool isFiltered = filter.finish(rows);
+  BufferTab* filteredTab = filteringTab;
+  filteredTab->isFiltering = false;
+  filteringTab = nullptr;
+  if (!isFiltered) {
+    commandPrompt = "Filter failed: " + filter.getError();
+    return;
+  }
+  // the output replaces the rows as they were, so edits made meanwhile win
+  if (filteredTab != tab || tab->versions.getVersion() != filterVersion) {
+    commandPrompt = "Buffer changed while filtering, dropped the output";
+    return;
+  }
+  size_t first = 0;
+  size_t count = 0;
+  tab->buf.getSelectedRows(filterCursors, first, count);
+  size_t rowCount = rows.size();
+  BufferOperation bufOp = tab->buf.filterRows(filterCursors, std::move(rows));
+  saveBufOp(bufOp);
+  cursors = filterCursors;
+  setSearchResults({});
+  searchResults.isValid = false;
+  commandPrompt = "Filtered " + std::to_string(count) + " rows into " +
+                  std::to_string(rowCount);
+}
+void Pane::startProjectSearch(const std::string& query,
+                              const std::string& directory) {
+  if (!projectSearch.start(directory, query)) {
+    commandPrompt = "Can't search " + directory;
+    return;
+  }
+  // the results fill a new tab as they're found
+  size_t index = buffers.openTab("");
+  searchTab = buffers.getTab(index);
+  searchTab->isSearchResults = true;
+  showTab(index);
+  commandPrompt = "Searching " + directory + " for " + query +
+                  ", enter opens a result";
+}
+void Pane::openSearchResult() {
+  std::string path{};
+  BufferPosition position{};
+  size_t row = getLeadCursor().getRow();
+  if (row >= tab->buf.lines.size() ||
+      !ProjectSearch::parseResult(tab->buf.lines[row], path, position)) {
+    commandPrompt = "Not a search result";
+    return;
+  }
+  struct stat st {};
+  if (stat(path.c_str(), &st) < 0) {
+    commandPrompt = "Can't open " + path;
+    return;
+  }
+  loadFromFile(path);
+  // the file may have changed since it was searched
+  size_t lastRow = tab->buf.lines.size() > 0 ? tab->buf.lines.size() - 1 : 0;
+  position.row = std::min(position.row, lastRow);
+  cursors = {BufferCursor{}};
+  cursors[0].moveSet(position.col, position.row);
+  commandPrompt = "";
 }
 void Pane::handleSearch() {
   if (searchResults.isValid && searchResults.results.size() > 0) {
@@ -101,7 +684,7 @@ void Pane::handleSearch() {
     searchResults.index += 1;
     searchResults.index %= searchResults.results.size();
   } else {
-    searchResults.results = getMatches(userCommandArgs);
+    setSearchResults(getMatches(userCommandArgs));
     searchResults.index = 0;
     searchResults.isValid = true;
   }
@@ -110,30 +693,57 @@ void Pane::handleSearch() {
     cursors.push_back(searchResults.results[searchResults.index]);
   }
 }
+size_t Pane::updateCompletions() {
+  completions.clear();
+  BufferCursor leadCursor = getLeadCursor();
+  if (tab->buf.lines.size() == 0 ||
+      leadCursor.getPosition() != leadCursor.getTailPosition())
+    return 0;
+  const std::string& line = tab->buf.lines[leadCursor.getRow()];
+  size_t end = std::min(leadCursor.getCol(), line.size());
+  size_t start = end;
+  while (start > 0 &&
+         (isalnum((unsigned char)line[start - 1]) || line[start - 1] == '_'))
+    start--;
+  if (end - start < 2)
+    return 0;
+  completions = tab->wordIndex.complete(line.substr(start, end - start), 5);
+  return end - start;
+}
+void Pane::acceptCompletion() {
+  size_t prefixSize = updateCompletions();
+  if (completions.size() == 0)
+    return;
+  BufferOperation bufOp =
+      tab->buf.insertTextAtCursors(cursors, completions[0].substr(prefixSize));
+  saveBufOp(bufOp);
+  completions.clear();
+}
+void Pane::setSearchResults(std::vector<BufferCursor> results) {
+  MemoryStats::add(
+      MS_SEARCH,
+      -(long long)(searchResults.results.capacity() * sizeof(BufferCursor)),
+      -(searchResults.results.capacity() > 0));
+  searchResults.results = std::move(results);
+  MemoryStats::add(
+      MS_SEARCH, searchResults.results.capacity() * sizeof(BufferCursor),
+      searchResults.results.capacity() > 0);
+}
 void Pane::saveBufOp(BufferOperation& bufOp) {
-  if (opStackPosition < (int)opStack.size()) {
-    opStack.erase(opStack.begin() + opStackPosition, opStack.end());
-  }
-  opStack.push_back(std::move(bufOp));
-  opStackPosition++;
+  // a grouped replay is recorded as a whole once it's done
+  if (isReplaying && macro.isGrouping())
+    return;
+  tab->pushOperation(std::move(bufOp));
 }
 void Pane::undoLastBufOp() {
-  if (opStackPosition > 0) {
-    opStackPosition--;
-    cursors = opStack[opStackPosition].iCursors;
-    buf.undoBufferOperation(opStack[opStackPosition]);
-  }
+  const BufferOperation* bufOp = tab->undo();
+  if (bufOp != nullptr)
+    cursors.assign(bufOp->iCursors.begin(), bufOp->iCursors.end());
 }
 void Pane::redoNextBufOp() {
-  if (opStackPosition < (int)opStack.size()) {
-    cursors = opStack[opStackPosition].oCursors;
-    BufferOperation bufCopy = opStack[opStackPosition];
-    bufCopy.oCursors.clear();
-    bufCopy.removedTexts.clear();
-    buf.doBufferOperation(
-        bufCopy);  // use a copy so we ignore changes to ocursors/removedTexts
-    opStackPosition++;
-  }
+  const BufferOperation* bufOp = tab->redo();
+  if (bufOp != nullptr)
+    cursors.assign(bufOp->oCursors.begin(), bufOp->oCursors.end());
 }
 void Pane::handleCommandKeypress(int keycode) {
   bool isHandledPress = false;
@@ -142,9 +752,16 @@ void Pane::handleCommandKeypress(int keycode) {
       isHandledPress = true;
       switch (command) {
         case SAVE:
+          if (savingTab != nullptr || tab->isSaving) {
+            commandPrompt = "Already saving, try again when it finishes";
+            userCommandArgs = "";
+            paneFocus = PF_TEXT;
+            break;
+          }
           saveBufferToFile(userCommandArgs);
-          filename = userCommandArgs;
-          commandPrompt = "Saved File";
+          tab->filename = userCommandArgs;
+          highlighter.setLanguage(tab->filename);
+          commandPrompt = "Saving File";
           userCommandArgs = "";
           paneFocus = PF_TEXT;
           break;
@@ -157,6 +774,11 @@ void Pane::handleCommandKeypress(int keycode) {
         case FIND:
           handleSearch();
           break;
+        case EXECUTE:
+          paneFocus = PF_TEXT;
+          runCommand(userCommandArgs);
+          userCommandArgs = "";
+          break;
       }
       break;
     case ESCAPE:
@@ -199,7 +821,29 @@ void Pane::handleTextKeypress(int keycode) {
   int maxX, maxY;
   getmaxyx(window, maxY, maxX);
   bool isHandledPress = false;
+  completions.clear();
+  if (macro.isRecording() && !isReplaying)
+    macro.record(keycode);
+  if (keycode == CARRIAGE_RETURN && tab->isSearchResults) {
+    // a replay stays on the tab it started on
+    if (isReplaying)
+      return;
+    openSearchResult();
+    redraw();
+    return;
+  }
   switch (keycode) {
+    case CTRL_R:
+      isHandledPress = true;
+      if (macro.isRecording()) {
+        macro.stopRecording();
+        commandPrompt = "Recorded " + std::to_string(macro.getKeys().size()) +
+                        " keys, replay with macro";
+      } else {
+        macro.startRecording();
+        commandPrompt = "Recording, ctrl-r to stop";
+      }
+      break;
     case CTRL_S:
       initiateSaveCommand();
       return;
@@ -209,64 +853,87 @@ void Pane::handleTextKeypress(int keycode) {
     case CTRL_D:
       initiateFindCommand();
       return;
+    case CTRL_P:
+      initiateExecuteCommand();
+      return;
+    case CTRL_W:
+      isHandledPress = true;
+      closeTab();
+      break;
+    case CTRL_PAGE_UP:
+      isHandledPress = true;
+      showTab((buffers.indexOf(tab) + buffers.size() - 1) % buffers.size());
+      break;
+    case CTRL_PAGE_DOWN:
+      isHandledPress = true;
+      showTab((buffers.indexOf(tab) + 1) % buffers.size());
+      break;
     case ARROW_UP:
       isHandledPress = true;
       for (BufferCursor& c : cursors) {
-        c.moveUp(buf);
+        c.moveUp(tab->buf, tab->folds);
       }
       break;
     case ARROW_DOWN:
       isHandledPress = true;
       for (BufferCursor& c : cursors) {
-        c.moveDown(buf);
+        c.moveDown(tab->buf, tab->folds);
       }
       break;
     case ARROW_LEFT:
       isHandledPress = true;
       for (BufferCursor& c : cursors) {
-        c.moveLeft(buf);
+        c.moveLeft(tab->buf, tab->folds);
       }
       break;
     case ARROW_RIGHT:
       isHandledPress = true;
       for (BufferCursor& c : cursors) {
-        c.moveRight(buf);
+        c.moveRight(tab->buf, tab->folds);
       }
       break;
     case SHIFT_UP:
       isHandledPress = true;
       for (BufferCursor& c : cursors) {
-        c.selectUp(buf);
+        c.selectUp(tab->buf, tab->folds);
       }
       break;
     case SHIFT_DOWN:
       isHandledPress = true;
       for (BufferCursor& c : cursors) {
-        c.selectDown(buf);
+        c.selectDown(tab->buf, tab->folds);
       }
       break;
     case SHIFT_LEFT:
       isHandledPress = true;
       for (BufferCursor& c : cursors) {
-        c.selectLeft(buf);
+        c.selectLeft(tab->buf, tab->folds);
       }
       break;
     case SHIFT_RIGHT:
       isHandledPress = true;
       for (BufferCursor& c : cursors) {
-        c.selectRight(buf);
+        c.selectRight(tab->buf, tab->folds);
       }
       break;
     case PAGE_UP:
       isHandledPress = true;
+      if (isWrapped) {
+        pageWrapped(-maxY / 2, false);
+        break;
+      }
       for (BufferCursor& c : cursors) {
-        c.movePageUp(maxY);
+        c.movePageUp(tab->folds, maxY);
       }
       break;
     case PAGE_DOWN:
       isHandledPress = true;
+      if (isWrapped) {
+        pageWrapped(maxY / 2, false);
+        break;
+      }
       for (BufferCursor& c : cursors) {
-        c.movePageDown(buf, maxY);
+        c.movePageDown(tab->buf, tab->folds, maxY);
       }
       break;
     case HOME:
@@ -278,19 +945,27 @@ void Pane::handleTextKeypress(int keycode) {
     case END:
       isHandledPress = true;
       for (BufferCursor& c : cursors) {
-        c.moveEnd(buf);
+        c.moveEnd(tab->buf);
       }
       break;
     case SHIFT_PAGE_UP:
       isHandledPress = true;
+      if (isWrapped) {
+        pageWrapped(-maxY / 2, true);
+        break;
+      }
       for (BufferCursor& c : cursors) {
-        c.selectPageUp(maxY);
+        c.selectPageUp(tab->folds, maxY);
       }
       break;
     case SHIFT_PAGE_DOWN:
       isHandledPress = true;
+      if (isWrapped) {
+        pageWrapped(maxY / 2, true);
+        break;
+      }
       for (BufferCursor& c : cursors) {
-        c.selectPageDown(buf, maxY);
+        c.selectPageDown(tab->buf, tab->folds, maxY);
       }
       break;
     case SHIFT_HOME:
@@ -302,9 +977,16 @@ void Pane::handleTextKeypress(int keycode) {
     case SHIFT_END:
       isHandledPress = true;
       for (BufferCursor& c : cursors) {
-        c.selectEnd(buf);
+        c.selectEnd(tab->buf);
       }
       break;
+    case RESIZE:
+      isHandledPress = true;
+      break;
+    case CTRL_B:
+      isHandledPress = true;
+      jumpToMatchingBrackets();
+      break;
     case CTRL_Z:
       isHandledPress = true;
       undoLastBufOp();
@@ -313,34 +995,170 @@ void Pane::handleTextKeypress(int keycode) {
       isHandledPress = true;
       redoNextBufOp();
       break;
+    case CTRL_N:
+      isHandledPress = true;
+      acceptCompletion();
+      break;
+    case CTRL_K:
+      isHandledPress = true;
+      clipboard.copy(tab->buf, cursors);
+      break;
+    case CTRL_V:
+      if (!clipboard.isEmpty()) {
+        isHandledPress = true;
+        BufferOperation bufOp = tab->buf.pasteAtCursors(
+            cursors, clipboard.getSlices(cursors.size()));
+        saveBufOp(bufOp);
+      }
+      break;
     default:
       if ((keycode >= 32 && keycode <= 126) || keycode == CARRIAGE_RETURN ||
           keycode == BACKSPACE || keycode == DELETE || keycode == TAB ||
           keycode == CTRL_UP || keycode == CTRL_DOWN) {
         isHandledPress = true;
-        BufferOperation bufOp = buf.insertAtCursors(cursors, keycode);
+        BufferOperation bufOp = tab->buf.insertAtCursors(cursors, keycode);
         saveBufOp(bufOp);
+        if (!isReplaying)
+          updateCompletions();
       }
       break;
   }
-  if (isHandledPress) {
+  // a replay draws once it's done
+  if (isHandledPress && !isReplaying) {
     redraw();
   }
 }
+// moves every cursor to the bracket matching the one under it, or else the one
+// before it
+void Pane::jumpToMatchingBrackets() {
+  for (BufferCursor& c : cursors) {
+    BufferPosition position = c.getPosition();
+    BufferPosition match{};
+    bool isMatched = tab->brackets.findMatch(tab->buf, position, match);
+    if (!isMatched && position.col > 0) {
+      position.col--;
+      isMatched = tab->brackets.findMatch(tab->buf, position, match);
+    }
+    if (isMatched)
+      c.moveSet(match.col, match.row);
+  }
+}
+void Pane::updateBracketPair() {
+  BufferPosition position = getLeadCursor().getPosition();
+  BufferPosition match{};
+  if (tab->brackets.findMatch(tab->buf, position, match)) {
+    bracketPair[0] = position;
+    bracketPair[1] = match;
+    hasBracketPair = true;
+    return;
+  }
+  hasBracketPair = tab->brackets.findEnclosing(tab->buf, position,
+                                               bracketPair[0], bracketPair[1]);
+}
+void Pane::setWrapped(bool wrapped) {
+  isWrapped = wrapped;
+  offsetSegment = 0;
+  if (isWrapped) {
+    tab->buf.addObserver(&wrapIndex);
+    wrapIndex.reset(tab->buf, getWrapWidth());
+    bufOffset.col = 0;
+  } else {
+    tab->buf.removeObserver(&wrapIndex);
+    wrapIndex.reset(tab->buf, 0);
+  }
+}
+// folds the rows of the lead cursor's selection under its first row, or
+// without a selection the rows indented deeper than the cursor's row below it
+void Pane::foldAtCursor() {
+  const std::vector<std::string>& lines = tab->buf.lines;
+  BufferCursor lead = getLeadCursor();
+  size_t first = std::min(lead.getRow(), lead.getTailRow()) + 1;
+  size_t last = std::max(lead.getRow(), lead.getTailRow()) + 1;
+  if (first == last && first <= lines.size()) {
+    auto getIndent = [](const std::string& line) {
+      return line.find_first_not_of(" \t");
+    };
+    size_t indent = getIndent(lines[first - 1]);
+    size_t end = first;
+    while (last < lines.size()) {
+      size_t lineIndent = getIndent(lines[last]);
+      if (lineIndent != std::string::npos && lineIndent <= indent)
+        break;
+      last++;
+      // blank rows only belong to the fold if deeper rows follow them
+      if (lineIndent != std::string::npos)
+        end = last;
+    }
+    last = end;
+  }
+  last = std::min(last, lines.size());
+  if (first >= last || !tab->folds.fold(first, last)) {
+    commandPrompt = "Nothing to fold here";
+    return;
+  }
+  cursors = {BufferCursor{}};
+  cursors[0].moveSet(0, first - 1);
+  commandPrompt = "Folded " + std::to_string(last - first) + " rows";
+}
+// moves every cursor by screen rows instead of rows, to the same column of the
+// screen row it lands on
+void Pane::pageWrapped(int screenRows, bool isSelecting) {
+  const std::vector<std::string>& lines = tab->buf.lines;
+  if (lines.size() == 0)
+    return;
+  long screenRowCount = getScreenRowCount();
+  std::vector<size_t> breaks{};
+  for (BufferCursor& c : cursors) {
+    int screenX = 0;
+    size_t segment = getWrappedCol(c.getRow(), c.getCol(), screenX);
+    long target = getScreenRow(c.getRow()) + segment + screenRows;
+    size_t row = 0;
+    size_t col = 0;
+    if (target >= screenRowCount) {
+      row = tab->folds.getVisibleRow(lines.size() - 1);
+      col = lines[row].size();
+    } else if (target >= 0) {
+      row = getRowAt(target, segment);
+      const std::string& line = lines[row];
+      WrapIndex::getBreaks(line, wrapIndex.getWidth(), breaks);
+      // the last column of a screen row that wraps is the next one's first
+      size_t last =
+          segment < breaks.size() ? breaks[segment] - 1 : line.size();
+      col = segment > 0 ? breaks[segment - 1] : 0;
+      for (int x = 0; col < last && x < screenX; col++) {
+        x += line[col] != '\t' ? 1 : TABSTOPWIDTH - (x % TABSTOPWIDTH);
+      }
+    }
+    if (isSelecting)
+      c.selectSet(col, row);
+    else
+      c.moveSet(col, row);
+  }
+}
 
 void Pane::adjustOffsetToCursor(const BufferCursor& cursor) {
+  if (isWrapped) {
+    adjustWrappedOffsetToCursor(cursor);
+    return;
+  }
   constexpr int xPad = 4;
   constexpr int yPad = 3;
   constexpr int infoHeight = 2;
+  // a results tab stays empty until the first result comes in
+  if (tab->buf.lines.size() == 0)
+    return;
   int maxX, maxY;
   getmaxyx(window, maxY, maxX);
   int bufX = cursor.getCol();
   int bufY = cursor.getRow();
-  if (bufX > (int)buf.lines[bufY].size()) {
-    bufX = buf.lines[bufY].size();
+  if (bufX > (int)tab->buf.lines[bufY].size()) {
+    bufX = tab->buf.lines[bufY].size();
   }
+  // the lead cursor is revealed when it lands in a fold
+  while (tab->folds.isHidden(bufY))
+    tab->folds.unfold(bufY);
   int gutterWidth = getGutterWidth();
-  const std::string& line = buf.lines[bufY];
+  const std::string& line = tab->buf.lines[bufY];
   int lIndex = 0;
   int screenX = 0;
   while (lIndex < bufX) {
@@ -353,18 +1171,39 @@ void Pane::adjustOffsetToCursor(const BufferCursor& cursor) {
     lIndex++;
   }
   screenX += gutterWidth - bufOffset.col;
-  int screenY = bufY - bufOffset.row;
+  int cursorY = tab->folds.getScreenRow(bufY);
+  int screenY = cursorY - tab->folds.getScreenRow(bufOffset.row);
   if (screenX < xPad + gutterWidth) {
     bufOffset.col = std::max(bufX - xPad, 0);
   } else if (screenX >= maxX - xPad) {
     bufOffset.col = bufX - maxX + 1 + xPad + gutterWidth;
   }
   if (screenY < yPad) {
-    bufOffset.row = std::max(0, bufY - yPad);
+    bufOffset.row = tab->folds.getRow(std::max(0, cursorY - yPad));
   } else if (screenY >= maxY - infoHeight - yPad) {
-    bufOffset.row = bufY - maxY + yPad + infoHeight + 1;
+    bufOffset.row = tab->folds.getRow(cursorY - maxY + yPad + infoHeight + 1);
   }
 }
+void Pane::adjustWrappedOffsetToCursor(const BufferCursor& cursor) {
+  constexpr int yPad = 3;
+  constexpr int infoHeight = 2;
+  if (tab->buf.lines.size() == 0)
+    return;
+  long textHeight = getmaxy(window) - infoHeight;
+  while (tab->folds.isHidden(cursor.getRow()))
+    tab->folds.unfold(cursor.getRow());
+  int screenX = 0;
+  size_t segment = getWrappedCol(cursor.getRow(), cursor.getCol(), screenX);
+  long cursorY = getScreenRow(cursor.getRow()) + segment;
+  long top = getScreenRow(bufOffset.row) + offsetSegment;
+  if (cursorY - top < yPad) {
+    top = std::max(0L, cursorY - yPad);
+  } else if (cursorY - top >= textHeight - yPad) {
+    top = cursorY - textHeight + yPad + 1;
+  }
+  bufOffset.row = getRowAt(top, offsetSegment);
+  bufOffset.col = 0;
+}
 void Pane::adjustOffset() {
   if (cursors.size() == 0)
     return;
@@ -377,7 +1216,10 @@ void Pane::drawBlankLine(int row, int maxX, PALETTES color) const {
   for (int col = 0; col < maxX; col++)
     waddch(window, ' ');
 }
-void Pane::drawGutter(int row, int lineNumber, int gutterWidth) const {
+void Pane::drawGutter(int row,
+                      int lineNumber,
+                      int gutterWidth,
+                      const Diagnostic* diagnostic) const {
   wmove(window, row, 0);
   char lineNumBuf[16];
   int digits = std::snprintf(lineNumBuf, 16, "%d", lineNumber + 1);
@@ -390,11 +1232,21 @@ void Pane::drawGutter(int row, int lineNumber, int gutterWidth) const {
     }
     waddch(window, lineNumBuf[digits - 1 - digit]);
   }
-  waddch(window, ' ');
+  if (diagnostic == nullptr) {
+    // folded rows are marked in the same column
+    waddch(window, tab->folds.getFold(lineNumber) != nullptr ? '+' : ' ');
+    return;
+  }
+  // build diagnostics mark the column after the line number
+  bool isError = diagnostic->severity == DS_ERROR;
+  wattron(window, COLOR_PAIR(isError ? N_ERROR : N_WARNING));
+  waddch(window, isError ? 'E' : 'W');
 }
 void Pane::drawLine(int lineNumber, int startCol, int sz) const {
   wattron(window, COLOR_PAIR(N_TEXT));
-  const std::string& line = buf.lines[lineNumber];
+  const std::string& line = tab->buf.lines[lineNumber];
+  const std::vector<StyleRun>& runs = highlighter.getRuns(lineNumber);
+  size_t runIndex = 0;
   int lIndex = 0;
   int screenX = 0;
   // find the first character lIndex in line that is after startCol, accounting
@@ -415,10 +1267,14 @@ void Pane::drawLine(int lineNumber, int startCol, int sz) const {
   }
   // for every cell in the terminal, add the appropriate character
   for (int i = 0; i < sz; i++) {
+    while (runIndex < runs.size() && runs[runIndex].start <= (size_t)lIndex) {
+      wattron(window, COLOR_PAIR(runs[runIndex].color));
+      runIndex++;
+    }
     if (lIndex >= (int)line.size()) {
       waddch(window, ' ');
     } else if (line[lIndex] != '\t') {
-      waddch(window, line.at(lIndex));
+      drawChar(lineNumber, lIndex);
     } else {
       int tabWidth = TABSTOPWIDTH - ((i + startCol) % TABSTOPWIDTH);
       for (int j = 0; j < tabWidth; j++) {
@@ -429,28 +1285,121 @@ void Pane::drawLine(int lineNumber, int startCol, int sz) const {
     lIndex++;
   }
 }
+void Pane::drawLineSegment(int lineNumber, int start, int end, int sz) const {
+  wattron(window, COLOR_PAIR(N_TEXT));
+  const std::string& line = tab->buf.lines[lineNumber];
+  const std::vector<StyleRun>& runs = highlighter.getRuns(lineNumber);
+  size_t runIndex = 0;
+  int lIndex = start;
+  // tabs are expanded from the start of the screen row
+  for (int i = 0; i < sz; i++) {
+    while (runIndex < runs.size() && runs[runIndex].start <= (size_t)lIndex) {
+      wattron(window, COLOR_PAIR(runs[runIndex].color));
+      runIndex++;
+    }
+    if (lIndex >= end) {
+      waddch(window, ' ');
+    } else if (line[lIndex] != '\t') {
+      drawChar(lineNumber, lIndex);
+    } else {
+      int tabWidth = TABSTOPWIDTH - (i % TABSTOPWIDTH);
+      for (int j = 0; j < tabWidth; j++) {
+        waddch(window, ' ');
+      }
+      i += (tabWidth - 1);
+    }
+    lIndex++;
+  }
+}
+void Pane::drawChar(int lineNumber, int lIndex) const {
+  char c = tab->buf.lines[lineNumber][lIndex];
+  for (int i = 0; i < 2 && hasBracketPair; i++) {
+    if (bracketPair[i].row == (size_t)lineNumber &&
+        bracketPair[i].col == (size_t)lIndex) {
+      waddch(window, c | A_BOLD | A_UNDERLINE);
+      return;
+    }
+  }
+  waddch(window, c);
+}
 void Pane::drawInfoRow(int maxX, int maxY) const {
   BufferCursor leadCursor = getLeadCursor();
   int cursorRow = leadCursor.getRow();
   int cursorCol = leadCursor.getCol();
-  const char* filename_cstr = filename.c_str();
-  int infoSz = std::snprintf(nullptr, 0, "%s (%d, %d)", filename_cstr,
-                             cursorRow, cursorCol) +
+  const char* filename_cstr = tab->filename.c_str();
+  const char* modified_cstr = tab->isModified() ? "*" : "";
+  int tabNumber = buffers.indexOf(tab) + 1;
+  int tabCount = buffers.size();
+  int infoSz = std::snprintf(nullptr, 0, "[%d/%d] %s%s (%d, %d)", tabNumber,
+                             tabCount, filename_cstr, modified_cstr, cursorRow,
+                             cursorCol) +
                1;
   if (infoSz > maxX)
     infoSz = maxX;
   std::unique_ptr<char[]> infoBuf(new char[infoSz]);
-  std::snprintf(infoBuf.get(), infoSz, "%s (%d, %d)", filename_cstr, cursorRow,
-                cursorCol);
-  wattron(window, COLOR_PAIR(N_INFO));
+  std::snprintf(infoBuf.get(), infoSz, "[%d/%d] %s%s (%d, %d)", tabNumber,
+                tabCount, filename_cstr, modified_cstr, cursorRow, cursorCol);
+  std::string info{infoBuf.get()};
+  size_t byteCount = tab->lineIndex.getByteCount();
+  size_t byte = 0;
+  if (cursorRow < (int)tab->buf.lines.size()) {
+    byte = tab->lineIndex.getRowOffset(cursorRow) +
+           std::min((size_t)cursorCol, tab->buf.lines[cursorRow].size());
+  }
+  info.append("  byte " + std::to_string(byte) + " of " +
+              std::to_string(byteCount) + " (" +
+              std::to_string(byteCount > 0 ? byte * 100 / byteCount : 100) +
+              "%)");
+  if (isWrapped) {
+    size_t screenRow = getScreenRow(bufOffset.row) + offsetSegment;
+    info.append("  screen row " + std::to_string(screenRow + 1) + " of " +
+                std::to_string(getScreenRowCount()));
+  }
+  if (completions.size() > 0) {
+    info.append("  [");
+    for (size_t i = 0; i < completions.size(); i++) {
+      if (i > 0)
+        info.append(" ");
+      info.append(completions[i]);
+    }
+    info.append("]");
+  }
+  if (tab->loadError.size() > 0)
+    info.append("  " + tab->loadError);
+  if (savingTab != nullptr) {
+    info.append("  saving " + std::to_string(saver.getProgress()) + "%");
+  } else if (saveStatus.size() > 0) {
+    info.append("  " + saveStatus);
+  }
+  if (filteringTab == tab)
+    info.append("  filtering");
+  std::string searchStatus = projectSearch.getStatus();
+  if (searchStatus.size() > 0)
+    info.append("  " + searchStatus);
+  std::string buildStatus = builder.getStatus();
+  if (buildStatus.size() > 0) {
+    info.append("  " + buildStatus);
+    // the diagnostic on the cursor's row, if any
+    const std::map<size_t, Diagnostic>* diagnostics =
+        builder.getDiagnostics(tab->filename);
+    if (diagnostics != nullptr && diagnostics->count(cursorRow) > 0)
+      info.append(": " + diagnostics->at(cursorRow).message);
+  }
+  if (isMemoryShown) {
+    info.append("  " + MemoryStats::formatSummary());
+  }
+  // the focused pane's info row stands out from the others
+  int focusAttr = isFocused ? A_BOLD : A_DIM;
+  wattron(window, COLOR_PAIR(N_INFO) | focusAttr);
   wmove(window, maxY - 2, 0);
   for (int col = 0; col < maxX; col++) {
-    if (col < infoSz - 1) {
-      waddch(window, infoBuf.get()[col]);
+    if (col < (int)info.size()) {
+      waddch(window, info[col]);
     } else {
       waddch(window, ' ');
     }
   }
+  wattroff(window, focusAttr);
 }
 void Pane::drawCommandRow(int maxX, int maxY) const {
   size_t promptSize = commandPrompt.size();
@@ -481,53 +1430,123 @@ void Pane::drawCommandRow(int maxX, int maxY) const {
   }
 }
 void Pane::drawBuffer() const {
-  if (buf.lines.size() == 0)
+  // an empty buffer still gets its blank rows, info and command rows
+  if (isWrapped) {
+    drawWrappedBuffer();
     return;
+  }
   int gutterWidth = getGutterWidth();
   int maxX, maxY;
   getmaxyx(window, maxY, maxX);
-  for (int row = 0; row < maxY - 2; row++) {
-    int lineNumber = row + bufOffset.row;
-    if (lineNumber >= (int)buf.lines.size()) {
+  const std::map<size_t, Diagnostic>* diagnostics =
+      builder.getDiagnostics(tab->filename);
+  // folded rows are stepped over, not counted through
+  int lineNumber = bufOffset.row;
+  for (int row = 0; row < maxY - 2;
+       row++, lineNumber = tab->folds.getNextRow(lineNumber)) {
+    if (lineNumber >= (int)tab->buf.lines.size()) {
       drawBlankLine(row, maxX, N_TEXT);
       continue;
     }
-    drawGutter(row, lineNumber, gutterWidth);
+    const Diagnostic* diagnostic = nullptr;
+    if (diagnostics != nullptr) {
+      auto found = diagnostics->find(lineNumber);
+      if (found != diagnostics->end())
+        diagnostic = &found->second;
+    }
+    drawGutter(row, lineNumber, gutterWidth, diagnostic);
     drawLine(lineNumber, bufOffset.col, maxX - gutterWidth);
   }
   drawInfoRow(maxX, maxY);
   drawCommandRow(maxX, maxY);
 }
 
+void Pane::drawWrappedBuffer() const {
+  const std::vector<std::string>& lines = tab->buf.lines;
+  int gutterWidth = getGutterWidth();
+  int maxX, maxY;
+  getmaxyx(window, maxY, maxX);
+  const std::map<size_t, Diagnostic>* diagnostics =
+      builder.getDiagnostics(tab->filename);
+  size_t row = bufOffset.row;
+  size_t segment = offsetSegment;
+  std::vector<size_t> breaks{};
+  if (row < lines.size())
+    WrapIndex::getBreaks(lines[row], wrapIndex.getWidth(), breaks);
+  for (int screenY = 0; screenY < maxY - 2; screenY++) {
+    if (row >= lines.size()) {
+      drawBlankLine(screenY, maxX, N_TEXT);
+      continue;
+    }
+    // the line number only goes beside the first screen row of a row
+    if (segment == 0) {
+      const Diagnostic* diagnostic = nullptr;
+      if (diagnostics != nullptr) {
+        auto found = diagnostics->find(row);
+        if (found != diagnostics->end())
+          diagnostic = &found->second;
+      }
+      drawGutter(screenY, row, gutterWidth, diagnostic);
+    } else {
+      drawBlankLine(screenY, gutterWidth, N_GUTTER);
+    }
+    size_t start = segment > 0 ? breaks[segment - 1] : 0;
+    size_t end = segment < breaks.size() ? breaks[segment] : lines[row].size();
+    drawLineSegment(row, start, end, maxX - gutterWidth);
+    if (++segment > breaks.size()) {
+      row = tab->folds.getNextRow(row);
+      segment = 0;
+      if (row < lines.size())
+        WrapIndex::getBreaks(lines[row], wrapIndex.getWidth(), breaks);
+    }
+  }
+  drawInfoRow(maxX, maxY);
+  drawCommandRow(maxX, maxY);
+}
+
 void Pane::drawSingleCursor(const BufferCursor& cursor, int gutterWidth) const {
   int maxX, maxY;
   getmaxyx(window, maxY, maxX);
   int bufX = cursor.getCol();
   int bufY = cursor.getRow();
-  int screenY = bufY - bufOffset.row;
-  if (screenY < 0 || screenY >= maxY - 2)
-    return;
-  if (bufX > (int)buf.lines[bufY].size()) {
-    bufX = buf.lines[bufY].size();
-  }
-  const std::string& line = buf.lines[bufY];
-  int lIndex = 0;
   int screenX = 0;
-  while (lIndex < bufX) {
-    if (line[lIndex] != '\t') {
-      screenX += 1;
-    } else {
-      int tabWidth = TABSTOPWIDTH - (screenX % TABSTOPWIDTH);
-      screenX += tabWidth;
+  int screenY = 0;
+  if (tab->folds.isHidden(bufY))
+    return;
+  if (isWrapped) {
+    size_t segment = getWrappedCol(bufY, bufX, screenX);
+    screenY = (long)(getScreenRow(bufY) + segment) -
+              (long)(getScreenRow(bufOffset.row) + offsetSegment);
+    screenX += gutterWidth;
+    if (screenY < 0 || screenY >= maxY - 2 || screenX >= maxX)
+      return;
+  } else {
+    screenY = tab->folds.getScreenRow(bufY) -
+              tab->folds.getScreenRow(bufOffset.row);
+    if (screenY < 0 || screenY >= maxY - 2)
+      return;
+    // an empty buffer has no row under the cursor
+    const std::string empty{};
+    const std::string& line =
+        bufY < (int)tab->buf.lines.size() ? tab->buf.lines[bufY] : empty;
+    bufX = std::min(bufX, (int)line.size());
+    int lIndex = 0;
+    while (lIndex < bufX) {
+      if (line[lIndex] != '\t') {
+        screenX += 1;
+      } else {
+        int tabWidth = TABSTOPWIDTH - (screenX % TABSTOPWIDTH);
+        screenX += tabWidth;
+      }
+      int screenPos = screenX + gutterWidth - bufOffset.col;
+      if (screenPos >= maxX)
+        return;  // cursor is off screen to right
+      lIndex++;
     }
-    int screenPos = screenX + gutterWidth - bufOffset.col;
-    if (screenPos >= maxX)
-      return;  // cursor is off screen to right
-    lIndex++;
+    screenX += gutterWidth - bufOffset.col;
+    if (screenX < gutterWidth || screenX >= maxX)
+      return;
   }
-  screenX += gutterWidth - bufOffset.col;
-  if (screenX < gutterWidth || screenX >= maxX)
-    return;
   bool isSelection = cursor.getPosition() != cursor.getTailPosition();
   if (isSelection) {
     bool isSelectionTail = cursor.getPosition() > cursor.getTailPosition();
@@ -548,10 +1567,15 @@ void Pane::drawSelectionCursor(const BufferCursor& cursor) const {
       std::min(cursor.getPosition(), cursor.getTailPosition());
   BufferPosition end = std::max(cursor.getPosition(), cursor.getTailPosition());
   int gutterWidth = getGutterWidth();
-  for (size_t row = start.row; row <= end.row; row++) {
-    int screenY = row - bufOffset.row;
-    if (screenY < 0 || screenY >= maxY - 2)
-      continue;  // row is offscreen
+  const FoldSet& folds = tab->folds;
+  size_t firstRow = std::max(start.row, bufOffset.row);
+  if (folds.isHidden(firstRow))
+    firstRow = folds.getNextRow(folds.getVisibleRow(firstRow));
+  int top = folds.getScreenRow(bufOffset.row);
+  for (size_t row = firstRow; row <= end.row; row = folds.getNextRow(row)) {
+    int screenY = (int)folds.getScreenRow(row) - top;
+    if (screenY >= maxY - 2)
+      break;  // the rest is offscreen
     int selStartCol, selEndCol;
     if (start.row < row) {
       selStartCol = 0;
@@ -561,7 +1585,7 @@ void Pane::drawSelectionCursor(const BufferCursor& cursor) const {
       assert(false);
     }
     if (end.row > row) {
-      selEndCol = buf.lines[row].size();
+      selEndCol = tab->buf.lines[row].size();
     } else if (end.row == row) {
       selEndCol = end.col - 1;
     } else {
@@ -569,21 +1593,21 @@ void Pane::drawSelectionCursor(const BufferCursor& cursor) const {
     }
     if (selEndCol < 0)
       continue;  // selection ends at very beginning of line
-    if (selEndCol > (int)buf.lines[row].size()) {
-      selEndCol = buf.lines[row].size();
+    if (selEndCol > (int)tab->buf.lines[row].size()) {
+      selEndCol = tab->buf.lines[row].size();
     }
 
     int distance = 0;
     int startDistance = -1;
     int endDistance = -1;
-    for (int i = 0; i < (int)buf.lines[row].size(); i++) {
+    for (int i = 0; i < (int)tab->buf.lines[row].size(); i++) {
       if (i == selStartCol)
         startDistance = distance;
       if (i == selEndCol)
         endDistance = distance;
       if (startDistance >= 0 && endDistance >= 0)
         break;
-      if (buf.lines[row][i] == '\t') {
+      if (tab->buf.lines[row][i] == '\t') {
         int tabWidth = TABSTOPWIDTH - (distance % TABSTOPWIDTH);
         distance += tabWidth;
       } else {
@@ -615,11 +1639,61 @@ void Pane::drawSelectionCursor(const BufferCursor& cursor) const {
              N_HIGHLIGHT, nullptr);
   }
 }
+void Pane::drawWrappedSelection(const BufferCursor& cursor) const {
+  const std::vector<std::string>& lines = tab->buf.lines;
+  int maxX, maxY;
+  getmaxyx(window, maxY, maxX);
+  BufferPosition start =
+      std::min(cursor.getPosition(), cursor.getTailPosition());
+  BufferPosition end = std::max(cursor.getPosition(), cursor.getTailPosition());
+  int gutterWidth = getGutterWidth();
+  const FoldSet& folds = tab->folds;
+  size_t top = getScreenRow(bufOffset.row) + offsetSegment;
+  size_t bottom = top + maxY - 2;
+  std::vector<size_t> breaks{};
+  size_t firstRow = std::max(start.row, bufOffset.row);
+  if (folds.isHidden(firstRow))
+    firstRow = folds.getNextRow(folds.getVisibleRow(firstRow));
+  for (size_t row = firstRow; row <= end.row && row < lines.size();
+       row = folds.getNextRow(row)) {
+    size_t rowY = getScreenRow(row);
+    if (rowY >= bottom)
+      break;  // the rest is offscreen
+    const std::string& line = lines[row];
+    size_t selStart = row == start.row ? std::min(start.col, line.size()) : 0;
+    // a selection running past the row selects its newline as one more cell
+    size_t selEnd =
+        row == end.row ? std::min(end.col, line.size()) : line.size() + 1;
+    WrapIndex::getBreaks(line, wrapIndex.getWidth(), breaks);
+    size_t segment = 0;
+    int screenX = 0;
+    for (size_t i = 0; i < selEnd; i++) {
+      if (segment < breaks.size() && i == breaks[segment]) {
+        segment++;
+        screenX = 0;
+      }
+      int cellWidth = i < line.size() && line[i] == '\t'
+                          ? TABSTOPWIDTH - (screenX % TABSTOPWIDTH)
+                          : 1;
+      size_t screenY = rowY + segment;
+      if (i >= selStart && screenY >= top && screenY < bottom &&
+          gutterWidth + screenX < maxX) {
+        mvwchgat(window, screenY - top, gutterWidth + screenX,
+                 std::min(cellWidth, maxX - gutterWidth - screenX), 0,
+                 N_HIGHLIGHT, nullptr);
+      }
+      screenX += cellWidth;
+    }
+  }
+}
 void Pane::drawCursors() const {
   for (const BufferCursor& cursor : cursors) {
     int gutterWidth = getGutterWidth();
     if (cursor.getPosition() != cursor.getTailPosition()) {
-      drawSelectionCursor(cursor);
+      if (isWrapped)
+        drawWrappedSelection(cursor);
+      else
+        drawSelectionCursor(cursor);
     }
     drawSingleCursor(cursor, gutterWidth);
   }
@@ -627,8 +1701,8 @@ void Pane::drawCursors() const {
 
 std::vector<BufferCursor> Pane::getMatches(const std::string& query) const {
   std::vector<BufferCursor> result{};
-  for (size_t row = 0; row < buf.lines.size(); row++) {
-    const std::string& line = buf.lines[row];
+  for (size_t row = 0; row < tab->buf.lines.size(); row++) {
+    const std::string& line = tab->buf.lines[row];
     size_t start = 0;
     size_t match = 0;
     while ((match = line.find(query, start)) != std::string::npos) {
@@ -643,13 +1717,73 @@ std::vector<BufferCursor> Pane::getMatches(const std::string& query) const {
 }
 
 void Pane::refresh() const {
+  // panes share the screen, so each only marks what it drew
+  wnoutrefresh(window);
   doupdate();
 }
 void Pane::erase() const {
   werase(window);
 }
 int Pane::getGutterWidth() const {
-  return getNumDigits(buf.lines.size()) + 1;
+  return getNumDigits(tab->buf.lines.size()) + 1;
+}
+size_t Pane::getWrapWidth() const {
+  // one column is kept free for the cursor after the end of a row
+  return std::max(getmaxx(window) - getGutterWidth() - 1, 1);
+}
+// which screen row of row col is on when wrapped, and its column there
+size_t Pane::getWrappedCol(size_t row, size_t col, int& screenX) const {
+  const std::string empty{};
+  const std::string& line =
+      row < tab->buf.lines.size() ? tab->buf.lines[row] : empty;
+  col = std::min(col, line.size());
+  std::vector<size_t> breaks{};
+  WrapIndex::getBreaks(line, wrapIndex.getWidth(), breaks);
+  size_t segment =
+      std::upper_bound(breaks.begin(), breaks.end(), col) - breaks.begin();
+  screenX = 0;
+  for (size_t i = segment > 0 ? breaks[segment - 1] : 0; i < col; i++) {
+    screenX += line[i] != '\t' ? 1 : TABSTOPWIDTH - (screenX % TABSTOPWIDTH);
+  }
+  return segment;
+}
+size_t Pane::getScreenRow(size_t row) const {
+  const FoldSet& folds = tab->folds;
+  if (!isWrapped)
+    return folds.getScreenRow(row);
+  // a fold hides every screen row its rows wrap to
+  row = folds.getVisibleRow(row);
+  size_t screenRow = wrapIndex.getScreenRow(row);
+  for (const Fold& fold : folds.getFolds()) {
+    if (fold.first > row)
+      break;
+    screenRow -=
+        wrapIndex.getScreenRow(fold.last) - wrapIndex.getScreenRow(fold.first);
+  }
+  return screenRow;
+}
+size_t Pane::getRowAt(size_t screenRow, size_t& segment) const {
+  const FoldSet& folds = tab->folds;
+  segment = 0;
+  if (!isWrapped)
+    return folds.getRow(screenRow);
+  size_t hidden = 0;
+  for (const Fold& fold : folds.getFolds()) {
+    size_t foldStart = wrapIndex.getScreenRow(fold.first);
+    if (screenRow + hidden < foldStart)
+      break;
+    hidden += wrapIndex.getScreenRow(fold.last) - foldStart;
+  }
+  return wrapIndex.getRow(screenRow + hidden, segment);
+}
+size_t Pane::getScreenRowCount() const {
+  if (tab->buf.lines.size() == 0)
+    return 0;
+  if (!isWrapped)
+    return tab->buf.lines.size() - tab->folds.getHiddenCount();
+  size_t lastRow = tab->folds.getVisibleRow(tab->buf.lines.size() - 1);
+  return getScreenRow(lastRow) + wrapIndex.getScreenRow(lastRow + 1) -
+         wrapIndex.getScreenRow(lastRow);
 }
 BufferCursor Pane::getLeadCursor() const {
   return cursors[cursors.size() - 1];
@@ -1,12 +1,154 @@
 #pragma once
 #include <ncurses.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
-enum PALETTES { N_TEXT = 1, N_GUTTER, N_INFO, N_COMMAND, N_HIGHLIGHT };
+enum PALETTES {
+  N_TEXT = 1,
+  N_GUTTER,
+  N_INFO,
+  N_COMMAND,
+  N_HIGHLIGHT,
+  N_KEYWORD,
+  N_COMMENT,
+  N_STRING,
+  N_NUMBER,
+  N_PREPROC,
+  N_ERROR,
+  N_WARNING,
+};
 
 class BufferCursor;
 class BufferOperation;
+class EditBuffer;
+class FoldSet;
+
+// rows of copied text, shared by the clipboard and every paste of it
+using LineSlice = std::shared_ptr<const std::vector<std::string>>;
+// slices are accounted to the clipboard for as long as anything shares them
+LineSlice makeLineSlice(std::vector<std::string>* rows);
+
+// a row edited in place, and what it held before
+struct RowChange {
+  size_t row{};
+  std::string text{};
+};
+
+// notified around every change to the rows of a buffer. linesWillChange is
+// called before rows [row, row + count) are replaced and linesChanged after
+// rows [row, row + removed) were replaced by [row, row + inserted).
+// linesRotated follows std::rotate: row middle became row first.
+// rowsReplaced follows many rows edited in place at once, in shards of
+// ascending rows that can be handled in parallel. rowsWillMove is called
+// before any change but a row edited in place, since rows inserted, removed,
+// rotated or reloaded can move every row in memory
+class BufferObserver {
+ public:
+  virtual ~BufferObserver() = default;
+  virtual void bufferLoaded(const EditBuffer&, const std::string&) {}
+  virtual void rowsWillMove(const EditBuffer&) {}
+  virtual void linesWillChange(const EditBuffer&, size_t, size_t) {}
+  virtual void linesChanged(const EditBuffer& buf,
+                            size_t row,
+                            size_t removed,
+                            size_t inserted) = 0;
+  virtual void linesRotated(const EditBuffer& buf,
+                            size_t first,
+                            size_t,
+                            size_t last) {
+    linesChanged(buf, first, last - first, last - first);
+  }
+  virtual void rowsReplaced(const EditBuffer& buf,
+                            const std::vector<std::vector<RowChange>>& shards) {
+    for (const std::vector<RowChange>& shard : shards) {
+      for (const RowChange& change : shard) {
+        linesChanged(buf, change.row, 1, 1);
+      }
+    }
+  }
+};
+
+// replaces the values of rows [row, row + removed) of a per-row array with
+// inserted copies of value. rows after them only move if the count changed
+template <typename T>
+void spliceRowValues(std::vector<T>& values,
+                     size_t row,
+                     size_t removed,
+                     size_t inserted,
+                     const T& value) {
+  if (inserted < removed)
+    values.erase(values.begin() + row + inserted,
+                 values.begin() + row + removed);
+  else
+    values.insert(values.begin() + row + removed, inserted - removed, value);
+  std::fill(values.begin() + row, values.begin() + row + inserted, value);
+}
+
+// calls f(shard) for every shard in [0, shardCount), spread over the cores
+template <typename F>
+void forEachShard(size_t shardCount, F f) {
+  size_t threadCount = std::min<size_t>(
+      std::max(1u, std::thread::hardware_concurrency()), shardCount);
+  std::atomic<size_t> nextShard{0};
+  auto work = [&nextShard, shardCount, &f]() {
+    for (size_t shard; (shard = nextShard++) < shardCount;)
+      f(shard);
+  };
+  std::vector<std::thread> threads{};
+  for (size_t t = 1; t < threadCount; t++) {
+    threads.emplace_back(work);
+  }
+  work();
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+}
+
+enum MemorySubsystem {
+  MS_LINES,
+  MS_UNDO,
+  MS_SEARCH,
+  MS_CLIPBOARD,
+  MS_WORDS,
+  MS_SNAPSHOTS,
+  MS_COUNT,
+};
+
+struct MemoryUsage {
+  long long bytes{};
+  long long allocations{};
+  long long overhead{};
+};
+
+// live heap usage of each subsystem, updated wherever the subsystem grows or
+// shrinks. overhead estimates what malloc uses on top of the requested bytes
+class MemoryStats {
+ public:
+  static void add(MemorySubsystem subsystem,
+                  long long bytes,
+                  long long allocations,
+                  long long overhead = 0);
+  // the bytes added, or taken away for a negative sign
+  static long long addString(MemorySubsystem subsystem,
+                             const std::string& str,
+                             int sign);
+  static long long getMallocOverhead(long long bytes);
+  static MemoryUsage get(MemorySubsystem subsystem);
+  static std::string formatSummary();
+  static std::string formatReport();
+  static std::string formatBytes(long long bytes);
+};
 
 struct SearchResults {
   bool isValid{false};
@@ -25,28 +167,90 @@ bool operator<=(const BufferPosition&, const BufferPosition&);
 bool operator>(const BufferPosition&, const BufferPosition&);
 bool operator>=(const BufferPosition&, const BufferPosition&);
 
+// rows [row, row + removed) replaced by rows
+struct RowSplice {
+  size_t row{};
+  size_t removed{};
+  std::vector<std::string> rows{};
+};
+
 // data from file
 class EditBuffer {
  public:
   std::vector<std::string> lines{};
   BufferOperation insertAtCursors(std::vector<BufferCursor>& cursors,
                                   int keycode);
+  BufferOperation insertTextAtCursors(std::vector<BufferCursor>& cursors,
+                                      const std::string& text);
+  // one slice per cursor
+  BufferOperation pasteAtCursors(std::vector<BufferCursor>& cursors,
+                                 const std::vector<LineSlice>& slices);
+  BufferOperation replaceAll(std::vector<BufferCursor>& cursors,
+                             const std::string& query,
+                             const std::string& replacement,
+                             size_t& count);
+  // reorders the selected rows. kind is sort, unique or reverse, and count
+  // the rows there were to reorder
+  BufferOperation reorderRows(std::vector<BufferCursor>& cursors,
+                              const std::string& kind,
+                              size_t& count);
+  // replaces the rows the selections span, or every row, with rows
+  BufferOperation filterRows(std::vector<BufferCursor>& cursors,
+                             std::vector<std::string>&& rows);
+  // the rows the selections span, or every row without one
+  void getSelectedRows(const std::vector<BufferCursor>& cursors,
+                       size_t& first,
+                       size_t& count) const;
   void undoBufferOperation(const BufferOperation& bufOp);
-  void loadFromFile(const std::string& filename);
+  // leaves the rows as they were when the file can't be opened
+  bool loadFromFile(const std::string& filename);
   void doBufferOperation(BufferOperation& bufOp);
+  ~EditBuffer();
+  void unload();
+  BufferOperation spliceRows(const std::vector<RowSplice>& splices);
+  void appendText(const char* text, size_t size, bool continuesLastRow);
+  // O(1)
+  size_t getMemoryUsage() const;
+  void addObserver(BufferObserver* observer);
+  void removeObserver(BufferObserver* observer);
 
  private:
+  std::vector<BufferObserver*> observers{};
+  size_t accountedCapacity{};
+  // the bytes of the rows' own buffers, kept up as they're accounted
+  long long accountedBytes{};
+  // recycles the arrays of undone and truncated operations, so typing
+  // doesn't reach malloc once the pool has warmed up
+  std::pmr::unsynchronized_pool_resource opResource{};
+  void accountLines(size_t row, size_t count, int sign);
+  void accountCapacity();
+  void notifyRowsWillMove();
+  void notifyLinesWillChange(size_t row, size_t count, bool isInPlace = false);
+  void notifyLinesChanged(size_t row, size_t removed, size_t inserted);
+  void notifyLinesRotated(size_t first, size_t middle, size_t last);
   void insertTextAtCursor(BufferCursor& cursor, const std::string& text);
+  void insertLinesAtCursor(BufferCursor& cursor,
+                           const std::vector<std::string>& slice);
   void backspaceAtCursor(BufferCursor& cursor, std::string& removedText);
   void deleteAtCursor(BufferCursor& cursor, std::string& removedText);
   void slideUpAtCursor(BufferCursor& cursor);
   void slideDownAtCursor(BufferCursor& cursor);
   BufferCursor selectPrecedingText(const std::string& insertText,
                                    BufferCursor insertCursor);
+  BufferCursor selectPrecedingLines(const std::vector<std::string>& slice,
+                                    BufferCursor insertCursor);
   void undoInsertText(const BufferOperation& bufOp);
+  void undoPaste(const BufferOperation& bufOp);
   void undoClearSelection(const BufferOperation& bufOp);
   void undoSlideUp(const BufferOperation& bufOp);
   void undoSlideDown(const BufferOperation& bufOp);
+  size_t replaceRows(BufferOperation& bufOp);
+  void undoReplace(const BufferOperation& bufOp);
+  size_t applyReorder(BufferOperation& bufOp);
+  void undoReorder(const BufferOperation& bufOp);
+  void applyFilter(BufferOperation& bufOp);
+  void undoFilter(const BufferOperation& bufOp);
+  void setRows(std::vector<std::vector<RowChange>>& shards);
   std::string clearSelection(BufferCursor& cursor);
   std::string stringifySelection(BufferCursor& cursor);
 };
@@ -57,20 +261,24 @@ class BufferCursor {
   BufferCursor(BufferPosition& pos);
   void moveSet(int col, int row);
   void selectSet(int col, int row);
-  void selectUp(const EditBuffer& buf);
-  void selectDown(const EditBuffer& buf);
-  void selectLeft(const EditBuffer& buf);
-  void selectRight(const EditBuffer& buf);
-  void selectPageUp(int termHeight);
-  void selectPageDown(const EditBuffer& buf, int termHeight);
+  void selectUp(const EditBuffer& buf, const FoldSet& folds);
+  void selectDown(const EditBuffer& buf, const FoldSet& folds);
+  void selectLeft(const EditBuffer& buf, const FoldSet& folds);
+  void selectRight(const EditBuffer& buf, const FoldSet& folds);
+  void selectPageUp(const FoldSet& folds, int termHeight);
+  void selectPageDown(const EditBuffer& buf,
+                      const FoldSet& folds,
+                      int termHeight);
   void selectHome();
   void selectEnd(const EditBuffer& buf);
-  void moveUp(const EditBuffer& buf);
-  void moveDown(const EditBuffer& buf);
-  void moveLeft(const EditBuffer& buf);
-  void moveRight(const EditBuffer& buf);
-  void movePageUp(int termHeight);
-  void movePageDown(const EditBuffer& buf, int termHeight);
+  void moveUp(const EditBuffer& buf, const FoldSet& folds);
+  void moveDown(const EditBuffer& buf, const FoldSet& folds);
+  void moveLeft(const EditBuffer& buf, const FoldSet& folds);
+  void moveRight(const EditBuffer& buf, const FoldSet& folds);
+  void movePageUp(const FoldSet& folds, int termHeight);
+  void movePageDown(const EditBuffer& buf,
+                    const FoldSet& folds,
+                    int termHeight);
   void moveHome();
   void moveEnd(const EditBuffer& buf);
   BufferPosition getPosition() const;
@@ -91,71 +299,1018 @@ enum BufOpType {
   BO_DELETE,
   BO_SLIDE_UP,
   BO_SLIDE_DOWN,
+  BO_PASTE,
+  BO_REPLACE,
+  BO_REORDER,
+  BO_FILTER,
 };
 
+// arrays are allocated from the resource of the buffer that made the
+// operation. insertTexts holds a single entry when every cursor inserts the
+// same text. a BO_REPLACE holds the query and its replacement instead, and
+// its removedTexts record where the replacements went rather than what they
+// removed. a BO_REORDER holds how the rows were reordered, and its
+// removedTexts the row every reordered row went to. a BO_FILTER replaces
+// whole rows with its one slice, and keeps the rows it replaced as a slice
+// too
 class BufferOperation {
  public:
   BufferOperation(BufOpType ot,
                   const std::vector<BufferCursor>& cursors,
-                  const std::vector<std::string>& texts);
+                  const std::vector<std::string>& texts,
+                  std::pmr::memory_resource* resource =
+                      std::pmr::get_default_resource());
   BufOpType opType;
-  std::vector<BufferCursor> iCursors;
-  std::vector<std::string> insertTexts;
-  std::vector<BufferCursor> oCursors{};
-  std::vector<std::string> removedTexts{};
+  std::pmr::vector<BufferCursor> iCursors;
+  std::pmr::vector<std::string> insertTexts;
+  std::vector<LineSlice> insertSlices{};
+  std::pmr::vector<BufferCursor> oCursors;
+  std::pmr::vector<std::string> removedTexts;
+  std::vector<LineSlice> removedSlices{};
+  const std::string& getInsertText(size_t i) const;
+  MemoryUsage getMemoryUsage() const;
+};
+
+enum LexState : unsigned char { LS_CODE, LS_BLOCK_COMMENT };
+
+// color starting at column start, up to the start of the next run
+struct StyleRun {
+  size_t start{};
+  PALETTES color{N_TEXT};
+};
+
+// caches style runs and the lexer state entering every lexed row. edited rows
+// are re-lexed lazily, only until the entering state of the next row matches
+// the cached one again
+class Highlighter : public BufferObserver {
+ public:
+  void setLanguage(const std::string& filename);
+  void bufferLoaded(const EditBuffer& buf,
+                    const std::string& filename) override;
+  void linesChanged(const EditBuffer& buf,
+                    size_t row,
+                    size_t removed,
+                    size_t inserted) override;
+  void linesRotated(const EditBuffer& buf,
+                    size_t first,
+                    size_t middle,
+                    size_t last) override;
+  void update(const EditBuffer& buf, size_t lastRow);
+  const std::vector<StyleRun>& getRuns(size_t row) const;
+
+ private:
+  bool isEnabled{false};
+  // there are no dirty rows while firstDirtyRow > lastDirtyRow
+  size_t firstDirtyRow{1};
+  size_t lastDirtyRow{0};
+  std::vector<LexState> startStates{};
+  std::vector<char> dirtyRows{};
+  std::vector<std::vector<StyleRun>> runs{};
+  void markDirty(size_t row);
+  void clear();
+  LexState lexLine(const std::string& line,
+                   LexState state,
+                   std::vector<StyleRun>& lineRuns) const;
+};
+
+// a word and its count in a treap ordered by word, prioritized by the word's
+// hash. every node keeps the highest count under it
+struct WordNode {
+  std::string word{};
+  size_t count{};
+  size_t maxCount{};
+  size_t priority{};
+  std::unique_ptr<WordNode> left{};
+  std::unique_ptr<WordNode> right{};
+};
+
+// word frequencies for autocomplete. the initial index is built from the file
+// on a background thread; edits made meanwhile are queued and merged when it
+// finishes
+class WordIndex : public BufferObserver {
+ public:
+  ~WordIndex();
+  void bufferLoaded(const EditBuffer& buf,
+                    const std::string& filename) override;
+  void linesWillChange(const EditBuffer& buf,
+                       size_t row,
+                       size_t count) override;
+  void linesChanged(const EditBuffer& buf,
+                    size_t row,
+                    size_t removed,
+                    size_t inserted) override;
+  void linesRotated(const EditBuffer&, size_t, size_t, size_t) override {}
+  void rowsReplaced(const EditBuffer& buf,
+                    const std::vector<std::vector<RowChange>>& shards) override;
+  // the most frequent words longer than the prefix, visiting O(k + log n)
+  // nodes
+  std::vector<std::string> complete(const std::string& prefix,
+                                    size_t maxResults);
+
+ private:
+  bool isBuilding{false};
+  std::atomic<bool> isBuildDone{false};
+  std::atomic<bool> isBuildCancelled{false};
+  std::thread builder{};
+  std::unique_ptr<WordNode> builtWords{};
+  std::unique_ptr<WordNode> words{};
+  std::unordered_map<std::string, long> pendingCounts{};
+  long long memoryUsage{};
+  long long memoryAllocations{};
+  long long builtMemoryUsage{};
+  long long builtMemoryAllocations{};
+  void account(const std::string& word, int sign);
+  void clearWords();
+  void cancelBuild();
+  void mergeBuild();
+  void countWords(const std::string& line, long delta);
+  void countWord(std::string word, long delta);
+};
+
+// keys recorded for replay. a grouped replay keeps the runs of rows it
+// changes, with the rows they held before, so the net change can be recorded
+// as one operation when it's done
+class Macro : public BufferObserver {
+ public:
+  bool isRecording() const;
+  void startRecording();
+  void stopRecording();
+  void record(int keycode);
+  const std::vector<int>& getKeys() const;
+  bool isGrouping() const;
+  void beginGroup();
+  void endGroup(const EditBuffer& buf,
+                std::vector<RowSplice>& splices,
+                std::vector<RowSplice>& reverts);
+  void linesWillChange(const EditBuffer& buf,
+                       size_t row,
+                       size_t count) override;
+  void linesChanged(const EditBuffer& buf,
+                    size_t row,
+                    size_t removed,
+                    size_t inserted) override;
+  void linesRotated(const EditBuffer& buf,
+                    size_t first,
+                    size_t middle,
+                    size_t last) override;
+  void rowsReplaced(const EditBuffer& buf,
+                    const std::vector<std::vector<RowChange>>& shards) override;
+
+ private:
+  // rows [row, row + count) now, and the rows there before the replay. rows
+  // between runs are as they were
+  struct ChangedRun {
+    size_t row{};
+    size_t count{};
+    std::vector<std::string> before{};
+  };
+  std::vector<ChangedRun>::iterator findRun(size_t row);
+  template <typename F>
+  void touch(size_t first, size_t last, F getBefore);
+
+  bool isRecordingKeys{false};
+  bool isGroupingRows{false};
+  std::vector<int> keys{};
+  // in row order, not overlapping or bordering
+  std::vector<ChangedRun> runs{};
+};
+
+// the offset each row starts at in the file it was loaded from or last saved
+// to, or -1 for rows changed since. while a save runs, the offsets the rows
+// will have in the new file are tracked as well
+class LineOrigins : public BufferObserver {
+ public:
+  std::string filename{};
+  std::vector<long long> offsets{};
+  void bufferLoaded(const EditBuffer& buf,
+                    const std::string& filename) override;
+  void linesChanged(const EditBuffer&,
+                    size_t row,
+                    size_t removed,
+                    size_t inserted) override;
+  void linesRotated(const EditBuffer&,
+                    size_t first,
+                    size_t middle,
+                    size_t last) override;
+  void beginSave(const EditBuffer& buf);
+  void endSave(const std::string& filename, bool isSaved);
+  // whether st is still the file the offsets point into
+  bool isSource(const struct stat& st) const;
+
+ private:
+  long long device{-1};
+  long long inode{-1};
+  long long size{-1};
+  long long mtime{-1};
+  bool isSaving{false};
+  std::vector<long long> pendingOffsets{};
+  static long long getMtime(const struct stat& st);
+  static void setOffsets(const EditBuffer& buf, std::vector<long long>& rows);
+  void stamp();
+};
+
+// a value per row, in blocks held by a treap ordered by row. every block keeps
+// the row count and sum under it, so prefix sums, finding the row a sum falls
+// in, and inserting or removing rows take O(log n) blocks and a walk along one
+class PrefixSums {
+ public:
+  void assign(std::vector<size_t>&& newValues);
+  void set(size_t row, size_t value);
+  // rows [row, row + removed) become inserted rows of value 0
+  void splice(size_t row, size_t removed, size_t inserted);
+  size_t get(size_t row) const;
+  size_t size() const;
+  // the sum of the first rows values
+  size_t getSum(size_t rows) const;
+  // the last row whose prefix sum is at most sum, which is left holding what
+  // remains of it past that prefix
+  size_t find(size_t& sum) const;
+
+ private:
+  struct Block {
+    std::vector<size_t> values{};
+    size_t valueSum{};
+    size_t priority{};
+    // of the block and the blocks under it
+    size_t rowCount{};
+    size_t sum{};
+    std::unique_ptr<Block> left{};
+    std::unique_ptr<Block> right{};
+  };
+  std::unique_ptr<Block> root{};
+  size_t priorityState{};
+  std::unique_ptr<Block> makeBlock(std::vector<size_t>&& values);
+  std::unique_ptr<Block> buildBlocks(const std::vector<size_t>& values);
+  // the block holding row, or the last one for the row after the last, and
+  // the blocks above it. row is left as the row's index in the block
+  Block* findBlock(size_t& row, std::vector<Block*>& path) const;
+  // the first rows go left, cutting the block they end in
+  void splitRows(std::unique_ptr<Block> block,
+                 size_t rows,
+                 std::unique_ptr<Block>& left,
+                 std::unique_ptr<Block>& right);
+  static std::unique_ptr<Block> merge(std::unique_ptr<Block> left,
+                                      std::unique_ptr<Block> right);
+  static void update(Block& block);
+};
+
+// the rows of one chunk of snapshots, accounted once they're copied in
+struct SnapshotChunk {
+  std::vector<std::string> rows{};
+  std::atomic<long long> bytes{};
+  ~SnapshotChunk();
+  void copy(const std::vector<std::string>& lines, size_t row, size_t count);
+};
+
+// the chunks of a snapshot still to be copied from its buffer. each is copied
+// once, by whoever needs it first: the snapshot's reader on its own thread, or
+// the buffer's thread just before it changes the chunk's rows
+class SnapshotCopies {
+ public:
+  struct Piece {
+    std::shared_ptr<SnapshotChunk> chunk{};
+    size_t row{};
+    size_t count{};
+  };
+  SnapshotCopies(const std::vector<std::string>& lines,
+                 std::vector<Piece>&& pieces);
+  // copies the pieces overlapping rows [first, last) nobody has taken yet, in
+  // parallel, and waits for the ones being copied elsewhere
+  void finish(size_t first, size_t last);
+
+ private:
+  const std::vector<std::string>& lines;
+  // in row order
+  std::vector<Piece> pieces{};
+  std::vector<std::atomic<int>> states{};
+};
+
+// an immutable copy of the rows of a buffer as they were at one version. rows
+// are held in chunks shared with every other snapshot they weren't edited
+// between, so a snapshot is cheap to take and to keep, and any thread can read
+// it while the buffer goes on changing. the reader calls fill() on its own
+// thread before reading, which copies the rows no earlier snapshot shared
+class BufferSnapshot {
+ public:
+  size_t getVersion() const;
+  size_t size() const;
+  void fill();
+  // O(log k) for k chunks
+  const std::string& operator[](size_t row) const;
+
+ private:
+  friend class BufferVersions;
+  size_t version{};
+  std::vector<LineSlice> chunks{};
+  std::shared_ptr<SnapshotCopies> copies{};
+  // the row every chunk starts at, and the row count after the last
+  std::vector<size_t> starts{0};
+};
+
+// counts the changes to a buffer and remembers the chunks its last snapshot
+// was made of. the next snapshot shares those still held by a snapshot, and an
+// edit drops only the chunks it touches. the rest are copied from the buffer
+// again, by the snapshot's reader unless the buffer changes them first, so a
+// chunk is freed with the last snapshot holding it
+class BufferVersions : public BufferObserver {
+ public:
+  ~BufferVersions();
+  BufferSnapshot snapshot(const EditBuffer& buf);
+  size_t getVersion() const;
+  // the bytes of the chunks snapshots still hold
+  size_t getMemoryUsage() const;
+  void bufferLoaded(const EditBuffer& buf, const std::string&) override;
+  void rowsWillMove(const EditBuffer&) override;
+  void linesWillChange(const EditBuffer&, size_t row, size_t count) override;
+  void linesChanged(const EditBuffer& buf,
+                    size_t row,
+                    size_t removed,
+                    size_t inserted) override;
+  void rowsReplaced(
+      const EditBuffer& buf,
+      const std::vector<std::vector<RowChange>>& shards) override;
+
+ private:
+  size_t version{};
+  // the last snapshot's chunks, which only snapshots keep alive. reset for
+  // chunks edited since
+  std::vector<std::weak_ptr<SnapshotChunk>> chunks{};
+  // the copies the last snapshot's reader hasn't made yet
+  std::weak_ptr<SnapshotCopies> copies{};
+  void finishCopies(size_t first, size_t last);
+  PrefixSums chunkSizes{};
+  size_t findChunk(size_t row, size_t& start) const;
+};
+
+// one slice per cursor of the last copy, shared by every paste of it
+class Clipboard {
+ public:
+  void copy(const EditBuffer& buf, const std::vector<BufferCursor>& cursors);
+  bool isEmpty() const;
+  // one slice per cursor, or everything joined at every cursor when the
+  // counts differ
+  std::vector<LineSlice> getSlices(size_t cursorCount);
+
+ private:
+  std::vector<LineSlice> slices{};
+  // every slice joined, made at the first paste that needs it
+  LineSlice joined{};
+  static void appendSelection(const EditBuffer& buf,
+                              BufferPosition start,
+                              BufferPosition end,
+                              std::vector<std::string>& rows);
+};
+
+// the byte length of every row, newline included, mapping between byte offsets
+// and positions in O(log n)
+class LineIndex : public BufferObserver {
+ public:
+  void bufferLoaded(const EditBuffer& buf, const std::string&) override;
+  void linesChanged(const EditBuffer& buf,
+                    size_t row,
+                    size_t removed,
+                    size_t inserted) override;
+  void linesRotated(const EditBuffer& buf,
+                    size_t first,
+                    size_t middle,
+                    size_t last) override;
+  size_t getRowOffset(size_t row);
+  BufferPosition getPosition(size_t offset);
+  size_t getByteCount();
+
+ private:
+  PrefixSums lengths{};
+};
+
+// the screen rows every row takes when soft wrapped to a width, mapping between
+// rows and screen rows in O(log n). rows wrap after the last blank that fits,
+// or mid-word when none does, and tabs are expanded from the start of each
+// screen row. a width of 0 wraps nothing and keeps no counts
+class WrapIndex : public BufferObserver {
+ public:
+  // recounts every row, in parallel, if the width changed
+  void setWidth(const EditBuffer& buf, size_t newWidth);
+  void reset(const EditBuffer& buf, size_t newWidth);
+  size_t getWidth() const;
+  void bufferLoaded(const EditBuffer& buf, const std::string&) override;
+  void linesChanged(const EditBuffer& buf,
+                    size_t row,
+                    size_t removed,
+                    size_t inserted) override;
+  void linesRotated(const EditBuffer& buf,
+                    size_t first,
+                    size_t middle,
+                    size_t last) override;
+  // the first screen row of row
+  size_t getScreenRow(size_t row) const;
+  // the row screenRow is part of, and which of its screen rows it is
+  size_t getRow(size_t screenRow, size_t& segment) const;
+  size_t getScreenRowCount() const;
+  // the columns every screen row of line but the first starts at
+  static void getBreaks(const std::string& line,
+                        size_t width,
+                        std::vector<size_t>& breaks);
+
+ private:
+  size_t width{};
+  PrefixSums counts{};
+  size_t countScreenRows(const std::string& line) const;
 };
 
+// the change in bracket depth over a span of rows, and the lowest the depth
+// gets relative to its start
+struct BracketDepth {
+  long sum{};
+  long minPrefix{};
+};
+
+// the bracket depth of every row, in blocks held by a treap ordered by row,
+// finding the bracket that matches another in O(log n) plus the length of the
+// two rows and of a block or two. every kind of bracket shares one depth, and
+// a match of the wrong kind counts as none. every block keeps the depth over
+// the rows under it, so inserting or removing rows is O(log n) too
+class BracketIndex : public BufferObserver {
+ public:
+  void bufferLoaded(const EditBuffer& buf, const std::string&) override;
+  void linesChanged(const EditBuffer& buf,
+                    size_t row,
+                    size_t removed,
+                    size_t inserted) override;
+  void linesRotated(const EditBuffer& buf,
+                    size_t first,
+                    size_t middle,
+                    size_t last) override;
+  bool findMatch(const EditBuffer& buf,
+                 BufferPosition position,
+                 BufferPosition& match) const;
+  // the innermost pair of brackets around position
+  bool findEnclosing(const EditBuffer& buf,
+                     BufferPosition position,
+                     BufferPosition& open,
+                     BufferPosition& close) const;
+
+ private:
+  struct Block {
+    std::vector<BracketDepth> rows{};
+    // over the block's own rows
+    BracketDepth depth{};
+    size_t priority{};
+    // of the block and the blocks under it
+    size_t rowCount{};
+    BracketDepth subtreeDepth{};
+    std::unique_ptr<Block> left{};
+    std::unique_ptr<Block> right{};
+  };
+  std::unique_ptr<Block> root{};
+  size_t priorityState{};
+  static BracketDepth measure(const std::string& line);
+  std::unique_ptr<Block> makeBlock(std::vector<BracketDepth>&& rows);
+  std::unique_ptr<Block> buildBlocks(const std::vector<BracketDepth>& rows);
+  void setRow(size_t row, BracketDepth depth);
+  void spliceRows(size_t row,
+                  size_t removed,
+                  std::vector<BracketDepth>&& inserted);
+  // the block holding row, or the last one for the row after the last, and
+  // the blocks above it. row is left as the row's index in the block
+  Block* findBlock(size_t& row, std::vector<Block*>& path) const;
+  // the first rows go left, cutting the block they end in
+  void splitRows(std::unique_ptr<Block> block,
+                 size_t rows,
+                 std::unique_ptr<Block>& left,
+                 std::unique_ptr<Block>& right);
+  static std::unique_ptr<Block> merge(std::unique_ptr<Block> left,
+                                      std::unique_ptr<Block> right);
+  static void update(Block& block);
+  bool findForward(const EditBuffer& buf,
+                   BufferPosition from,
+                   BufferPosition& match) const;
+  bool findBackward(const EditBuffer& buf,
+                    BufferPosition from,
+                    BufferPosition& match) const;
+  static bool scanForward(const std::string& line,
+                          size_t col,
+                          long& depth,
+                          size_t& match);
+  static bool scanBackward(const std::string& line,
+                           size_t col,
+                           long& depth,
+                           size_t& match);
+  // low is the row the block's subtree starts at
+  static size_t descendForward(const Block* block,
+                               size_t low,
+                               size_t from,
+                               long& depth);
+  static size_t descendBackward(const Block* block,
+                                size_t low,
+                                size_t before,
+                                long& depth);
+};
+
+// rows [first, last) hidden under row first - 1
+struct Fold {
+  size_t first{};
+  size_t last{};
+};
+
+// the folded rows of a buffer, as sorted ranges that never overlap, mapping
+// between rows and screen rows in O(log k) for k folds however many rows they
+// hide. a fold opens when its hidden rows are edited
+class FoldSet : public BufferObserver {
+ public:
+  bool fold(size_t first, size_t last);
+  // opens the fold row heads or is hidden by, returning how many rows it hid
+  size_t unfold(size_t row);
+  void clear();
+  const std::vector<Fold>& getFolds() const;
+  // the fold row heads, if any
+  const Fold* getFold(size_t row) const;
+  bool isHidden(size_t row) const;
+  // row, or the row heading the fold that hides it
+  size_t getVisibleRow(size_t row) const;
+  // the first row after visible row row that isn't hidden
+  size_t getNextRow(size_t row) const;
+  size_t getHiddenCount() const;
+  size_t getScreenRow(size_t row) const;
+  size_t getRow(size_t screenRow) const;
+  void bufferLoaded(const EditBuffer&, const std::string&) override;
+  void linesChanged(const EditBuffer&,
+                    size_t row,
+                    size_t removed,
+                    size_t inserted) override;
+
+ private:
+  std::vector<Fold> folds{};
+  // the rows hidden by the folds before each fold, then by all of them
+  std::vector<size_t> hiddenBefore{0};
+  size_t findFold(size_t row) const;
+  void count();
+};
+
+enum SaveDurability { SD_NONE, SD_DATA, SD_FULL };
+
+// writes rows joined by newlines into a temporary file beside the target and
+// renames it over the target. SD_DATA syncs the file before the rename, SD_FULL
+// also syncs the directory after it. long runs of rows that are unchanged in
+// the source file are copied from it by the kernel instead of written. start()
+// saves a snapshot of the rows on a background thread; finish() joins it once
+// isDone()
+class BufferSaver {
+ public:
+  ~BufferSaver();
+  bool save(const BufferSnapshot& lines,
+            const LineOrigins& source,
+            const std::string& filename,
+            SaveDurability durability);
+  // byteCount is what the rows add up to joined by newlines, for progress
+  void start(BufferSnapshot&& lines,
+             size_t byteCount,
+             const LineOrigins& source,
+             const std::string& filename,
+             SaveDurability durability);
+  bool isDone() const;
+  bool finish();
+  int getProgress() const;
+  const std::string& getError() const;
+
+ private:
+  std::string error{};
+  std::thread worker{};
+  BufferSnapshot snapshot{};
+  LineOrigins snapshotSource{};
+  std::atomic<bool> isWorkerDone{false};
+  std::atomic<size_t> bytesWritten{};
+  size_t totalBytes{};
+  bool isSuccess{false};
+  bool fail(const std::string& what, int fd, const std::string& tmpFilename);
+  bool writeLines(int fd,
+                  const BufferSnapshot& lines,
+                  const LineOrigins& source);
+  bool copyExtent(int sourceFd, int fd, long long offset, long long length);
+};
+
+// appends whatever gets written to the end of a file to its buffer. inotify
+// wakes poll(), which reads only the bytes past what was read before
+class FileFollower {
+ public:
+  ~FileFollower();
+  bool start(const std::string& filename, long long offset);
+  void stop();
+  bool isFollowing() const;
+  bool poll(EditBuffer& buf);
+
+ private:
+  int fd{-1};
+  int inotifyFd{-1};
+  long long offset{};
+  bool continuesLastRow{false};
+  bool isBehind{false};
+};
+
+enum DiagnosticSeverity { DS_WARNING, DS_ERROR };
+
+struct Diagnostic {
+  size_t col{};
+  DiagnosticSeverity severity{DS_ERROR};
+  std::string message{};
+};
+
+// runs a build command in the background. its output is read as it comes and
+// every file:line:col diagnostic is kept by the real path of its file
+class BuildRunner {
+ public:
+  ~BuildRunner();
+  bool start(const std::string& command);
+  void stop();
+  bool isRunning() const;
+  bool poll();
+  std::string getStatus() const;
+  const std::map<size_t, Diagnostic>* getDiagnostics(
+      const std::string& filename) const;
+
+ private:
+  pid_t pid{-1};
+  int outputFd{-1};
+  int exitStatus{};
+  std::string command{};
+  std::string pendingOutput{};
+  // make's directory changes, which relative paths are relative to
+  std::vector<std::string> directories{};
+  std::unordered_map<std::string, std::map<size_t, Diagnostic>> diagnostics{};
+  size_t counts[2]{};
+  void parseLine(const std::string& line);
+};
+
+// pipes rows of a snapshot through a shell command on a worker thread. the
+// rows are written to its stdin straight from the snapshot, a batch per
+// writev, and its stdout is split into rows as it's read
+class ShellFilter {
+ public:
+  ~ShellFilter();
+  bool start(const std::string& command,
+             BufferSnapshot&& snapshot,
+             size_t first,
+             size_t count);
+  void stop();
+  bool isRunning() const;
+  bool isDone() const;
+  // joins the worker and hands over the rows read, unless the command failed
+  bool finish(std::vector<std::string>& rows);
+  const std::string& getError() const;
+
+ private:
+  std::thread worker{};
+  pid_t pid{-1};
+  int inputFd{-1};
+  int outputFd{-1};
+  int errorFd{-1};
+  BufferSnapshot input{};
+  size_t first{};
+  size_t count{};
+  std::vector<std::string> output{};
+  bool isRowOpen{false};
+  std::string errorOutput{};
+  std::string error{};
+  int exitStatus{};
+  std::atomic<bool> isWorkerDone{false};
+  void run();
+  bool writeRows(size_t& row, std::vector<iovec>& iov, size_t& written);
+  void readRows(const char* data, size_t size);
+};
+
+// searches every file under a directory for a query on a pool of threads.
+// each file is memory-mapped and scanned with memchr, and the rows that match
+// are queued as path:row:col: text lines for poll() to append to a buffer
+class ProjectSearch {
+ public:
+  ~ProjectSearch();
+  bool start(const std::string& directory, const std::string& query);
+  void stop();
+  bool isRunning() const;
+  bool poll(EditBuffer& buf);
+  std::string getStatus() const;
+  // the file and position a result row points at
+  static bool parseResult(const std::string& row,
+                          std::string& path,
+                          BufferPosition& position);
+
+ private:
+  std::vector<std::thread> workers{};
+  std::mutex mutex{};
+  std::condition_variable wake{};
+  // paths still to search and whether they're directories, taken depth first
+  std::vector<std::pair<std::string, bool>> pending{};
+  size_t busyCount{};
+  std::string results{};
+  std::atomic<size_t> runningCount{};
+  std::atomic<bool> isStopping{false};
+  std::atomic<size_t> fileCount{};
+  std::atomic<size_t> matchCount{};
+  std::string directory{};
+  std::string query{};
+  // the byte of the query memchr looks for, the least common one
+  size_t needleIndex{};
+  void work();
+  void searchDirectory(const std::string& path);
+  void searchFile(const std::string& path);
+};
+
+// the row splices turning a buffer into the current contents of a file.
+// rows are hashed in parallel, the common head and tail are skipped and the
+// rest is diffed with myers' algorithm, up to a bounded number of edits
+class LineDiff {
+ public:
+  static bool diffFile(const EditBuffer& buf,
+                       const std::string& filename,
+                       std::vector<RowSplice>& splices);
+};
+
+// watches the directories of open files for files being written or renamed
+// into place, which is how git and most generators replace them
+class ChangeWatcher {
+ public:
+  ChangeWatcher();
+  ~ChangeWatcher();
+  void watch(const std::string& filename);
+  // the paths, as made by getPath, written since the last poll
+  std::vector<std::string> poll();
+  static std::string getPath(const std::string& filename);
+
+ private:
+  int inotifyFd{-1};
+  std::unordered_map<int, std::string> directories{};
+};
+
+enum JournalRecordType : unsigned char { JR_DO = 1, JR_UNDO, JR_REDO };
+
+struct JournalRecord {
+  JournalRecordType type{};
+  BufferOperation bufOp{BO_INSERT, {}, {}};
+};
+
+// an append-only log of the operations applied to a tab since its file was
+// loaded or saved, so unsaved edits survive a crash. records are encoded on
+// the ui thread and written and synced in batches by a writer thread. the
+// file is only created with the first record, and is removed when the tab is
+// closed or ned quits
+class Journal {
+ public:
+  ~Journal();
+  void open(const std::string& filename, long long validLength);
+  void rebase(const std::string& filename,
+              const std::vector<BufferOperation>& bufOps,
+              size_t first,
+              size_t undoCount);
+  void remove();
+  void recordOperation(const BufferOperation& bufOp);
+  void recordUndo();
+  void recordRedo();
+  // the records of the journal for filename if it was started against the
+  // file as it is now, and the length of the intact part of the journal
+  static long long read(const std::string& filename,
+                        std::vector<JournalRecord>& records);
+
+ private:
+  std::string path{};
+  std::string header{};
+  bool isOpen{false};
+  bool isStarted{false};
+  std::thread writer{};
+  std::mutex mutex{};
+  std::condition_variable wakeup{};
+  std::string pending{};
+  bool isResetPending{false};
+  bool isStopping{false};
+  void append(const std::string& record);
+  void stop();
+  void writeBatches();
+};
+
+// a file open in a tab along with its undo history and the view state of the
+// pane that showed it last
+class BufferTab {
+ public:
+  BufferTab(const std::string& filename);
+  ~BufferTab();
+  std::string filename{};
+  EditBuffer buf{};
+  WordIndex wordIndex{};
+  LineOrigins origins{};
+  LineIndex lineIndex{};
+  BufferVersions versions{};
+  FoldSet folds{};
+  BracketIndex brackets{};
+  bool isLoaded{false};
+  size_t lastViewed{};
+  // the panes showing it. a shown tab is never unloaded or closed under them
+  size_t viewCount{};
+  long long diskSize{-1};
+  // nanoseconds
+  long long diskMtime{-1};
+  // the directory watch saw the file being written
+  bool hasDiskEvent{false};
+  int opStackPosition{};
+  int savedOpStackPosition{};
+  // the position a background save will mark as saved once it succeeds
+  int savingOpStackPosition{-1};
+  // a pane is saving or filtering it in the background. panes share the tab,
+  // so a second save or filter waits and nobody closes it meanwhile
+  bool isSaving{false};
+  bool isFiltering{false};
+  std::vector<BufferOperation> opStack{};
+  long long historyBytes{};
+  std::vector<BufferCursor> cursors{BufferCursor{}};
+  BufferPosition bufOffset{};
+  Journal journal{};
+  FileFollower follower{};
+  size_t recoveredCount{};
+  // why the file couldn't be loaded, until it's saved
+  std::string loadError{};
+  // the results of a grep, whose rows enter opens
+  bool isSearchResults{false};
+  bool isModified() const;
+  bool isDiskChanged(const struct stat& st) const;
+  void stampDisk(const struct stat& st);
+  void truncateHistory(size_t size);
+  void pushOperation(BufferOperation&& bufOp);
+  // the rows, the undo history and the snapshots of the rows still held
+  size_t getMemoryUsage() const;
+  const BufferOperation* undo();
+  const BufferOperation* redo();
+  size_t recover();
+  void rebaseJournal();
+};
+
+// the open tabs. tabs are loaded when first shown, and inactive unmodified tabs
+// are unloaded again, least recently viewed first, whenever the loaded tabs
+// use more than the memory budget
+class BufferManager {
+ public:
+  BufferManager(size_t memoryBudget);
+  size_t openTab(const std::string& filename);
+  void closeTab(size_t index);
+  BufferTab* activateTab(size_t index);
+  BufferTab* getTab(size_t index) const;
+  size_t indexOf(const BufferTab* tab) const;
+  size_t getActiveIndex() const;
+  size_t size() const;
+
+ private:
+  size_t memoryBudget{};
+  size_t activeIndex{};
+  size_t viewCounter{};
+  std::vector<std::unique_ptr<BufferTab>> tabs{};
+  void loadTab(BufferTab& tab);
+  void unloadTab(BufferTab& tab);
+  void enforceMemoryBudget();
+};
+
+// keeps the cursors and offset of a pane on their rows while another pane
+// edits the buffer it shows. rows after an edit move with it, and positions
+// inside it are clamped to what replaced them
+class ViewAnchor : public BufferObserver {
+ public:
+  ViewAnchor(std::vector<BufferCursor>& cursors, BufferPosition& offset);
+  bool isEnabled{false};
+  void bufferLoaded(const EditBuffer& buf, const std::string&) override;
+  void linesChanged(const EditBuffer& buf,
+                    size_t row,
+                    size_t removed,
+                    size_t inserted) override;
+  void rowsReplaced(
+      const EditBuffer& buf,
+      const std::vector<std::vector<RowChange>>& shards) override;
+
+ private:
+  std::vector<BufferCursor>& cursors;
+  BufferPosition& offset;
+  void clamp(const EditBuffer& buf);
+};
+
+// a view of a tab. several panes can show the same tab, each with its own
+// cursors, offset and wrapping, and only the focused one takes keys
 class Pane {
  public:
-  Pane(WINDOW* window);
+  Pane(WINDOW* window, BufferManager& buffers, Clipboard& clipboard);
+  // another view of the tab other shows, where other is looking
+  Pane(WINDOW* window, const Pane& other);
+  ~Pane();
+  Pane(const Pane&) = delete;
+  Pane& operator=(const Pane&) = delete;
   void addCursor();
   int getKeypress() const;
   void handleKeypress(int keycode);
   void loadFromFile(const std::string& filename);
+  void showTab(size_t index);
+  void setFocused(bool focused);
   void redraw();
+  void tick();
+  void shutdown();
 
  private:
   int paneFocus{};
   int command{};
   int commandCursorPosition{};
-  int opStackPosition{};
+  int memoryDumpInterval{};
+  bool isMemoryShown{false};
+  long long lastMemoryDump{};
+  SaveDurability saveDurability{SD_DATA};
   WINDOW* window{};
-  std::string filename{};
   std::string commandPrompt{};
   std::string userCommandArgs{};
-  EditBuffer buf{};
+  BufferManager& buffers;
+  Clipboard& clipboard;
+  BufferTab* tab{};
+  Highlighter highlighter{};
   BufferPosition bufOffset{};
   std::vector<BufferCursor> cursors{BufferCursor{}};
-  std::vector<BufferOperation> opStack{};
+  ViewAnchor anchor{cursors, bufOffset};
+  bool isFocused{true};
+  std::vector<std::string> completions{};
   SearchResults searchResults{};
+  BufferSaver saver{};
+  BufferTab* savingTab{};
+  ChangeWatcher changeWatcher{};
+  std::string saveStatus{};
+  Macro macro{};
+  bool isReplaying{false};
+  BuildRunner builder{};
+  ShellFilter filter{};
+  // the tab being filtered, its version then and the selections filtered
+  BufferTab* filteringTab{};
+  size_t filterVersion{};
+  std::vector<BufferCursor> filterCursors{};
+  ProjectSearch projectSearch{};
+  // the tab a grep's results are appended to
+  BufferTab* searchTab{};
+  bool isWrapped{false};
+  WrapIndex wrapIndex{};
+  // which screen row of bufOffset.row is at the top of the pane when wrapped
+  size_t offsetSegment{};
+  // the brackets around the lead cursor, or the one under it and its match
+  BufferPosition bracketPair[2]{};
+  bool hasBracketPair{false};
   void initiateSaveCommand();
   void initiateOpenCommand();
   void initiateFindCommand();
-  void saveBufferToFile(const std::string& saveTarget) const;
+  void initiateExecuteCommand();
+  void runCommand(const std::string& commandLine);
+  void setSearchResults(std::vector<BufferCursor> results);
+  void closeTab();
+  void saveBufferToFile(const std::string& saveTarget);
+  void finishSave();
+  void startFilter(const std::string& command);
+  void finishFilter();
+  void startProjectSearch(const std::string& query,
+                          const std::string& directory);
+  void openSearchResult();
+  void checkDiskChanges();
+  void reloadFromDisk();
+  void replayMacro(size_t count, const std::string& query, bool isGrouped);
   void handleSearch();
+  size_t updateCompletions();
+  void acceptCompletion();
   void saveBufOp(BufferOperation& bufOp);
   void undoLastBufOp();
   void redoNextBufOp();
   void handleCommandKeypress(int keycode);
   void handleTextKeypress(int keycode);
+  void setWrapped(bool wrapped);
+  void pageWrapped(int screenRows, bool isSelecting);
+  void foldAtCursor();
+  void jumpToMatchingBrackets();
+  void updateBracketPair();
 
   void adjustOffsetToCursor(const BufferCursor& cursor);
+  void adjustWrappedOffsetToCursor(const BufferCursor& cursor);
   void adjustOffset();
 
   void drawBlankLine(int row, int maxX, PALETTES color) const;
-  void drawGutter(int row, int lineNumber, int gutterWidth) const;
+  void drawGutter(int row,
+                  int lineNumber,
+                  int gutterWidth,
+                  const Diagnostic* diagnostic) const;
   void drawLine(int lineNumber, int startCol, int sz) const;
+  void drawLineSegment(int lineNumber, int start, int end, int sz) const;
+  void drawChar(int lineNumber, int lIndex) const;
   void drawInfoRow(int maxX, int maxY) const;
   void drawCommandRow(int maxX, int maxY) const;
   void drawBuffer() const;
+  void drawWrappedBuffer() const;
 
   void drawSingleCursor(const BufferCursor& cursor, int gutterWidth) const;
   void drawSelectionCursor(const BufferCursor& cursor) const;
+  void drawWrappedSelection(const BufferCursor& cursor) const;
   void drawCursors() const;
 
   std::vector<BufferCursor> getMatches(const std::string& query) const;
   void refresh() const;
   void erase() const;
   int getGutterWidth() const;
+  size_t getWrapWidth() const;
+  // screen rows count wrapped rows and skip folded ones
+  size_t getScreenRow(size_t row) const;
+  size_t getRowAt(size_t screenRow, size_t& segment) const;
+  size_t getScreenRowCount() const;
+  size_t getWrappedCol(size_t row, size_t col, int& screenX) const;
   BufferCursor getLeadCursor() const;
 };
@@ -0,0 +1,229 @@
+#include <algorithm>
+#include <numeric>
+#include "pane.hh"
+
+namespace {
+// blocks are cut in two when an edit would make them twice this
+constexpr size_t PREFIX_BLOCK_ROWS = 256;
+}  // namespace
+
+void PrefixSums::assign(std::vector<size_t>&& newValues) {
+  root = buildBlocks(newValues);
+  std::vector<size_t>().swap(newValues);
+}
+void PrefixSums::set(size_t row, size_t value) {
+  std::vector<Block*> path{};
+  Block* block = findBlock(row, path);
+  size_t old = block->values[row];
+  block->values[row] = value;
+  block->valueSum += value - old;
+  for (Block* above : path) {
+    above->sum += value - old;
+  }
+}
+void PrefixSums::splice(size_t row, size_t removed, size_t inserted) {
+  if (removed == 0 && inserted == 0)
+    return;
+  std::vector<Block*> path{};
+  size_t index = row;
+  Block* block = root != nullptr ? findBlock(index, path) : nullptr;
+  if (block != nullptr && index + removed <= block->values.size()) {
+    size_t newSize = block->values.size() - removed + inserted;
+    if (newSize > 0 && newSize <= 2 * PREFIX_BLOCK_ROWS) {
+      // inside one block, which is edited in place
+      auto first = block->values.begin() + index;
+      size_t removedSum = std::accumulate(first, first + removed, (size_t)0);
+      block->values.erase(first, first + removed);
+      block->values.insert(block->values.begin() + index, inserted, 0);
+      block->valueSum -= removedSum;
+      for (Block* above : path) {
+        above->rowCount = above->rowCount - removed + inserted;
+        above->sum -= removedSum;
+      }
+      return;
+    }
+  }
+  std::unique_ptr<Block> left{}, middle{}, right{};
+  splitRows(std::move(root), row, left, right);
+  splitRows(std::move(right), removed, middle, right);
+  middle = nullptr;
+  root = merge(merge(std::move(left),
+                     buildBlocks(std::vector<size_t>(inserted, 0))),
+               std::move(right));
+}
+size_t PrefixSums::get(size_t row) const {
+  std::vector<Block*> path{};
+  return findBlock(row, path)->values[row];
+}
+size_t PrefixSums::size() const {
+  return root != nullptr ? root->rowCount : 0;
+}
+size_t PrefixSums::getSum(size_t rows) const {
+  size_t sum = 0;
+  for (const Block* block = root.get(); block != nullptr && rows > 0;) {
+    size_t leftRows = block->left != nullptr ? block->left->rowCount : 0;
+    if (rows <= leftRows) {
+      block = block->left.get();
+      continue;
+    }
+    if (block->left != nullptr)
+      sum += block->left->sum;
+    rows -= leftRows;
+    if (rows < block->values.size()) {
+      // from whichever end of the block is closer
+      auto split = block->values.begin() + rows;
+      if (rows <= block->values.size() / 2)
+        return sum + std::accumulate(block->values.begin(), split, (size_t)0);
+      return sum + block->valueSum -
+             std::accumulate(split, block->values.end(), (size_t)0);
+    }
+    sum += block->valueSum;
+    rows -= block->values.size();
+    block = block->right.get();
+  }
+  return sum;
+}
+size_t PrefixSums::find(size_t& sum) const {
+  // descend to the last row whose prefix sum is at most sum
+  size_t row = 0;
+  for (const Block* block = root.get(); block != nullptr;) {
+    size_t leftSum = block->left != nullptr ? block->left->sum : 0;
+    size_t leftRows = block->left != nullptr ? block->left->rowCount : 0;
+    if (leftSum > sum) {
+      block = block->left.get();
+      continue;
+    }
+    if (leftSum + block->valueSum <= sum) {
+      sum -= leftSum + block->valueSum;
+      row += leftRows + block->values.size();
+      block = block->right.get();
+      continue;
+    }
+    sum -= leftSum;
+    row += leftRows;
+    for (size_t value : block->values) {
+      if (value > sum)
+        break;
+      sum -= value;
+      row++;
+    }
+    break;
+  }
+  return row;
+}
+
+std::unique_ptr<PrefixSums::Block> PrefixSums::makeBlock(
+    std::vector<size_t>&& values) {
+  // splitmix64 of a counter, random enough to keep the treap balanced
+  size_t z = priorityState += 0x9e3779b97f4a7c15;
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+  auto block = std::make_unique<Block>();
+  block->priority = z ^ (z >> 31);
+  block->values = std::move(values);
+  block->valueSum =
+      std::accumulate(block->values.begin(), block->values.end(), (size_t)0);
+  update(*block);
+  return block;
+}
+std::unique_ptr<PrefixSums::Block> PrefixSums::buildBlocks(
+    const std::vector<size_t>& values) {
+  // in O(n): the right spine of the treap so far holds the blocks a new one
+  // can go under
+  std::unique_ptr<Block> built{};
+  std::vector<Block*> spine{};
+  for (size_t start = 0; start < values.size(); start += PREFIX_BLOCK_ROWS) {
+    auto first = values.begin() + start;
+    std::unique_ptr<Block> block = makeBlock(std::vector<size_t>(
+        first, first + std::min(PREFIX_BLOCK_ROWS, values.size() - start)));
+    while (spine.size() > 0 && spine.back()->priority < block->priority) {
+      update(*spine.back());
+      spine.pop_back();
+    }
+    std::unique_ptr<Block>& slot =
+        spine.size() > 0 ? spine.back()->right : built;
+    block->left = std::move(slot);
+    slot = std::move(block);
+    spine.push_back(slot.get());
+  }
+  while (spine.size() > 0) {
+    update(*spine.back());
+    spine.pop_back();
+  }
+  return built;
+}
+PrefixSums::Block* PrefixSums::findBlock(size_t& row,
+                                         std::vector<Block*>& path) const {
+  for (Block* block = root.get(); block != nullptr;) {
+    path.push_back(block);
+    size_t leftRows = block->left != nullptr ? block->left->rowCount : 0;
+    if (row < leftRows) {
+      block = block->left.get();
+      continue;
+    }
+    row -= leftRows;
+    if (row < block->values.size() ||
+        (row == block->values.size() && block->right == nullptr))
+      return block;
+    row -= block->values.size();
+    block = block->right.get();
+  }
+  return nullptr;
+}
+void PrefixSums::splitRows(std::unique_ptr<Block> block,
+                           size_t rows,
+                           std::unique_ptr<Block>& left,
+                           std::unique_ptr<Block>& right) {
+  // the treap is only O(log n) deep, so recursing down it is safe
+  if (block == nullptr) {
+    left = nullptr;
+    right = nullptr;
+    return;
+  }
+  size_t leftRows = block->left != nullptr ? block->left->rowCount : 0;
+  if (rows <= leftRows) {
+    splitRows(std::move(block->left), rows, left, block->left);
+    update(*block);
+    right = std::move(block);
+  } else if (rows >= leftRows + block->values.size()) {
+    splitRows(std::move(block->right), rows - leftRows - block->values.size(),
+              block->right, right);
+    update(*block);
+    left = std::move(block);
+  } else {
+    auto cut = block->values.begin() + (rows - leftRows);
+    std::unique_ptr<Block> tail =
+        makeBlock(std::vector<size_t>(cut, block->values.end()));
+    block->values.erase(cut, block->values.end());
+    block->valueSum -= tail->valueSum;
+    right = merge(std::move(tail), std::move(block->right));
+    update(*block);
+    left = std::move(block);
+  }
+}
+std::unique_ptr<PrefixSums::Block> PrefixSums::merge(
+    std::unique_ptr<Block> left,
+    std::unique_ptr<Block> right) {
+  if (left == nullptr)
+    return right;
+  if (right == nullptr)
+    return left;
+  if (left->priority > right->priority) {
+    left->right = merge(std::move(left->right), std::move(right));
+    update(*left);
+    return left;
+  }
+  right->left = merge(std::move(left), std::move(right->left));
+  update(*right);
+  return right;
+}
+void PrefixSums::update(Block& block) {
+  block.rowCount = block.values.size();
+  block.sum = block.valueSum;
+  for (const std::unique_ptr<Block>* child : {&block.left, &block.right}) {
+    if (*child != nullptr) {
+      block.rowCount += (*child)->rowCount;
+      block.sum += (*child)->sum;
+    }
+  }
+}
@@ -0,0 +1,276 @@
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <cctype>
+#include <cstring>
+#include "pane.hh"
+
+namespace {
+// a nul this early means a binary file, as it does to grep
+constexpr size_t BINARY_PROBE_BYTES = 8192;
+// long rows are cut, the result only has to be recognizable
+constexpr size_t MAX_RESULT_TEXT = 200;
+// past this many the search stops rather than fill memory with results
+constexpr size_t MAX_SEARCH_RESULTS = 100000;
+
+std::string joinPath(const std::string& directory, const char* name) {
+  if (directory == ".")
+    return name;
+  if (directory.size() > 0 && directory.back() == '/')
+    return directory + name;
+  return directory + "/" + name;
+}
+// how rarely a byte turns up in source, roughly
+int getRarity(char c) {
+  if (c == ' ' || c == '\t')
+    return 0;
+  if (islower((unsigned char)c))
+    return 1;
+  if (isalnum((unsigned char)c))
+    return 2;
+  return 3;
+}
+bool readNumber(const std::string& row, size_t& i, size_t& n) {
+  size_t start = i;
+  n = 0;
+  while (i < row.size() && isdigit((unsigned char)row[i]))
+    n = n * 10 + (row[i++] - '0');
+  return i > start;
+}
+}  // namespace
+
+ProjectSearch::~ProjectSearch() {
+  stop();
+}
+bool ProjectSearch::start(const std::string& directory,
+                          const std::string& query) {
+  stop();
+  struct stat st {};
+  if (query.size() == 0 || stat(directory.c_str(), &st) < 0 ||
+      !S_ISDIR(st.st_mode))
+    return false;
+  this->directory = directory;
+  this->query = query;
+  needleIndex = 0;
+  for (size_t i = 1; i < query.size(); i++) {
+    if (getRarity(query[i]) > getRarity(query[needleIndex]))
+      needleIndex = i;
+  }
+  pending = {{directory, true}};
+  busyCount = 0;
+  results.clear();
+  isStopping = false;
+  fileCount = 0;
+  matchCount = 0;
+  // searching is mostly waiting on the disk, so there are more threads than
+  // cores to keep it busy
+  size_t threadCount =
+      std::max(8u, 2 * std::max(1u, std::thread::hardware_concurrency()));
+  runningCount = threadCount;
+  for (size_t i = 0; i < threadCount; i++) {
+    workers.emplace_back([this]() { work(); });
+  }
+  return true;
+}
+void ProjectSearch::stop() {
+  {
+    std::lock_guard<std::mutex> lock{mutex};
+    isStopping = true;
+  }
+  wake.notify_all();
+  for (std::thread& worker : workers) {
+    worker.join();
+  }
+  workers.clear();
+  pending.clear();
+  results.clear();
+}
+bool ProjectSearch::isRunning() const {
+  return workers.size() > 0;
+}
+bool ProjectSearch::poll(EditBuffer& buf) {
+  // workers queue their results before they finish, so none are left behind
+  // once they all have
+  bool isFinished = workers.size() > 0 && runningCount == 0;
+  std::string found{};
+  {
+    std::lock_guard<std::mutex> lock{mutex};
+    found.swap(results);
+  }
+  if (found.size() > 0)
+    buf.appendText(found.data(), found.size(), false);
+  if (isFinished) {
+    for (std::thread& worker : workers) {
+      worker.join();
+    }
+    workers.clear();
+  }
+  return found.size() > 0 || isFinished;
+}
+std::string ProjectSearch::getStatus() const {
+  if (query.size() == 0)
+    return "";
+  std::string status = isRunning() ? "grepping " : "grep ";
+  status.append(std::to_string(matchCount) + " rows in " +
+                std::to_string(fileCount) + " files");
+  if (matchCount >= MAX_SEARCH_RESULTS)
+    status.append(", stopped at the limit");
+  return status;
+}
+bool ProjectSearch::parseResult(const std::string& row,
+                                std::string& path,
+                                BufferPosition& position) {
+  // path:row:col: text, where the path may hold colons of its own
+  for (size_t colon = row.find(':'); colon != std::string::npos;
+       colon = row.find(':', colon + 1)) {
+    size_t i = colon + 1;
+    size_t resultRow{}, resultCol{};
+    if (!readNumber(row, i, resultRow) || i >= row.size() || row[i] != ':')
+      continue;
+    i++;
+    if (!readNumber(row, i, resultCol) || i >= row.size() || row[i] != ':')
+      continue;
+    path = row.substr(0, colon);
+    position.row = resultRow > 0 ? resultRow - 1 : 0;
+    position.col = resultCol > 0 ? resultCol - 1 : 0;
+    return path.size() > 0;
+  }
+  return false;
+}
+
+void ProjectSearch::work() {
+  std::unique_lock<std::mutex> lock{mutex};
+  while (true) {
+    // out of paths with nobody left to find more means done
+    wake.wait(lock, [this]() {
+      return pending.size() > 0 || busyCount == 0 || isStopping;
+    });
+    if (isStopping || pending.size() == 0)
+      break;
+    std::pair<std::string, bool> entry = std::move(pending.back());
+    pending.pop_back();
+    busyCount++;
+    lock.unlock();
+    if (entry.second)
+      searchDirectory(entry.first);
+    else
+      searchFile(entry.first);
+    lock.lock();
+    busyCount--;
+    if (busyCount == 0 && pending.size() == 0)
+      wake.notify_all();
+  }
+  lock.unlock();
+  runningCount--;
+}
+void ProjectSearch::searchDirectory(const std::string& path) {
+  DIR* dir = opendir(path.c_str());
+  if (dir == nullptr)
+    return;
+  std::vector<std::pair<std::string, bool>> entries{};
+  while (dirent* entry = readdir(dir)) {
+    // hidden files and directories, .git among them, aren't searched
+    if (entry->d_name[0] == '.')
+      continue;
+    unsigned char type = entry->d_type;
+    if (type == DT_UNKNOWN) {
+      struct stat st {};
+      if (fstatat(dirfd(dir), entry->d_name, &st, AT_SYMLINK_NOFOLLOW) < 0)
+        continue;
+      type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : 0;
+    }
+    // symlinks are skipped, so a link to a parent can't loop
+    if (type == DT_DIR || type == DT_REG)
+      entries.emplace_back(joinPath(path, entry->d_name), type == DT_DIR);
+  }
+  closedir(dir);
+  if (entries.size() == 0)
+    return;
+  {
+    std::lock_guard<std::mutex> lock{mutex};
+    for (std::pair<std::string, bool>& entry : entries) {
+      pending.push_back(std::move(entry));
+    }
+  }
+  wake.notify_all();
+}
+void ProjectSearch::searchFile(const std::string& path) {
+  if (isStopping)
+    return;
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return;
+  struct stat st {};
+  if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+    close(fd);
+    return;
+  }
+  size_t size = st.st_size;
+  void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED)
+    return;
+  madvise(mapping, size, MADV_SEQUENTIAL);
+  fileCount++;
+  const char* begin = (const char*)mapping;
+  const char* end = begin + size;
+  std::string found{};
+  size_t foundCount = 0;
+  if (memchr(begin, '\0', std::min(size, BINARY_PROBE_BYTES)) == nullptr) {
+    // memchr skips to candidates for the query's rarest byte, and rows are
+    // only counted up to the ones that match. a row is reported once, at its
+    // first match
+    char needle = query[needleIndex];
+    size_t row = 0;
+    const char* rowStart = begin;
+    const char* next = begin + needleIndex;
+    while (next < end) {
+      next = (const char*)memchr(next, needle, end - next);
+      if (next == nullptr)
+        break;
+      const char* match = next - needleIndex;
+      if ((size_t)(end - match) < query.size())
+        break;
+      if (memcmp(match, query.data(), query.size()) != 0) {
+        next++;
+        continue;
+      }
+      for (const char* newline;
+           (newline = (const char*)memchr(rowStart, '\n', match - rowStart));) {
+        row++;
+        rowStart = newline + 1;
+      }
+      const char* rowEnd = (const char*)memchr(match, '\n', end - match);
+      if (rowEnd == nullptr)
+        rowEnd = end;
+      const char* textEnd = std::min(rowEnd, rowStart + MAX_RESULT_TEXT);
+      if (textEnd == rowEnd && textEnd > rowStart && textEnd[-1] == '\r')
+        textEnd--;
+      found.append(path + ":" + std::to_string(row + 1) + ":" +
+                   std::to_string(match - rowStart + 1) + ": ");
+      found.append(rowStart, textEnd);
+      found.push_back('\n');
+      foundCount++;
+      if (rowEnd == end)
+        break;
+      row++;
+      rowStart = rowEnd + 1;
+      next = rowStart + needleIndex;
+    }
+  }
+  munmap(mapping, size);
+  if (foundCount == 0)
+    return;
+  {
+    std::lock_guard<std::mutex> lock{mutex};
+    results.append(found);
+  }
+  if ((matchCount += foundCount) >= MAX_SEARCH_RESULTS) {
+    {
+      std::lock_guard<std::mutex> lock{mutex};
+      isStopping = true;
+    }
+    wake.notify_all();
+  }
+}
@@ -0,0 +1,219 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include "pane.hh"
+
+namespace {
+// every row separator points at the same byte
+char NEWLINE[]{'\n'};
+// only the start of what the command complains about is shown
+constexpr size_t MAX_ERROR_OUTPUT = 4096;
+
+void closePipe(int fds[2]) {
+  for (int i = 0; i < 2; i++) {
+    if (fds[i] >= 0)
+      close(fds[i]);
+  }
+}
+}  // namespace
+
+ShellFilter::~ShellFilter() {
+  stop();
+}
+bool ShellFilter::start(const std::string& command,
+                        BufferSnapshot&& snapshot,
+                        size_t first,
+                        size_t count) {
+  stop();
+  int fds[3][2]{{-1, -1}, {-1, -1}, {-1, -1}};
+  for (int i = 0; i < 3; i++) {
+    if (pipe2(fds[i], O_CLOEXEC) < 0) {
+      std::cout << "ERROR:ShellFilter::start pipe failed" << std::endl;
+      for (int j = 0; j < i; j++) {
+        closePipe(fds[j]);
+      }
+      return false;
+    }
+  }
+  pid = fork();
+  if (pid < 0) {
+    std::cout << "ERROR:ShellFilter::start fork failed" << std::endl;
+    for (int i = 0; i < 3; i++) {
+      closePipe(fds[i]);
+    }
+    return false;
+  }
+  if (pid == 0) {
+    // in a group of its own, so stopping reaches whatever it starts
+    setpgid(0, 0);
+    signal(SIGPIPE, SIG_DFL);
+    dup2(fds[0][0], STDIN_FILENO);
+    dup2(fds[1][1], STDOUT_FILENO);
+    dup2(fds[2][1], STDERR_FILENO);
+    execl("/bin/sh", "sh", "-c", command.c_str(), (char*)nullptr);
+    _exit(127);
+  }
+  setpgid(pid, pid);
+  close(fds[0][0]);
+  close(fds[1][1]);
+  close(fds[2][1]);
+  inputFd = fds[0][1];
+  outputFd = fds[1][0];
+  errorFd = fds[2][0];
+  for (int fd : {inputFd, outputFd, errorFd}) {
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+  }
+  input = std::move(snapshot);
+  this->first = first;
+  this->count = count;
+  output.clear();
+  isRowOpen = false;
+  errorOutput.clear();
+  error.clear();
+  isWorkerDone = false;
+  worker = std::thread([this]() { run(); });
+  return true;
+}
+void ShellFilter::stop() {
+  if (!worker.joinable())
+    return;
+  // the worker sees the pipes close and reaps it
+  if (!isWorkerDone)
+    kill(-pid, SIGKILL);
+  worker.join();
+  pid = -1;
+}
+bool ShellFilter::isRunning() const {
+  return worker.joinable();
+}
+bool ShellFilter::isDone() const {
+  return isWorkerDone;
+}
+bool ShellFilter::finish(std::vector<std::string>& rows) {
+  if (worker.joinable())
+    worker.join();
+  pid = -1;
+  if (!WIFEXITED(exitStatus) || WEXITSTATUS(exitStatus) != 0) {
+    error = WIFEXITED(exitStatus)
+                ? "exited with " + std::to_string(WEXITSTATUS(exitStatus))
+                : "killed";
+    std::string message = errorOutput.substr(0, errorOutput.find('\n'));
+    if (message.size() > 0)
+      error.append(": " + message);
+    std::vector<std::string>().swap(output);
+    return false;
+  }
+  rows = std::move(output);
+  output = {};
+  return true;
+}
+const std::string& ShellFilter::getError() const {
+  return error;
+}
+
+void ShellFilter::run() {
+  input.fill();
+  size_t row = first;
+  std::vector<iovec> iov{};
+  iov.reserve(IOV_MAX);
+  size_t written = 0;
+  char chunk[65536];
+  // stdin is written while the command keeps up and read from otherwise, so
+  // neither side can fill a pipe the other is waiting on
+  while (outputFd >= 0 || errorFd >= 0) {
+    pollfd fds[3]{{inputFd, POLLOUT, 0},
+                  {outputFd, POLLIN, 0},
+                  {errorFd, POLLIN, 0}};
+    if (::poll(fds, 3, -1) < 0) {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+    if (fds[0].revents != 0 && !writeRows(row, iov, written)) {
+      // everything was written, or the command stopped reading
+      close(inputFd);
+      inputFd = -1;
+    }
+    if (fds[1].revents != 0) {
+      ssize_t size = read(outputFd, chunk, sizeof(chunk));
+      if (size > 0) {
+        readRows(chunk, size);
+      } else if (size == 0 || errno != EAGAIN) {
+        close(outputFd);
+        outputFd = -1;
+      }
+    }
+    if (fds[2].revents != 0) {
+      ssize_t size = read(errorFd, chunk, sizeof(chunk));
+      if (size > 0) {
+        size_t kept = MAX_ERROR_OUTPUT - std::min(MAX_ERROR_OUTPUT,
+                                                  errorOutput.size());
+        errorOutput.append(chunk, std::min((size_t)size, kept));
+      } else if (size == 0 || errno != EAGAIN) {
+        close(errorFd);
+        errorFd = -1;
+      }
+    }
+  }
+  if (inputFd >= 0) {
+    close(inputFd);
+    inputFd = -1;
+  }
+  waitpid(pid, &exitStatus, 0);
+  // rows only the snapshot still held are freed here rather than on the ui
+  // thread
+  input = BufferSnapshot{};
+  isWorkerDone = true;
+}
+bool ShellFilter::writeRows(size_t& row,
+                            std::vector<iovec>& iov,
+                            size_t& written) {
+  // a batch of rows, each followed by a newline, picked up where the last
+  // write stopped
+  if (iov.size() == 0) {
+    written = 0;
+    for (; row < first + count && iov.size() < IOV_MAX - 1; row++) {
+      const std::string& line = input[row];
+      if (line.size() > 0)
+        iov.push_back(iovec{(void*)line.data(), line.size()});
+      iov.push_back(iovec{NEWLINE, 1});
+    }
+    if (iov.size() == 0)
+      return false;
+  }
+  ssize_t size = writev(inputFd, &iov[written], iov.size() - written);
+  if (size < 0)
+    return errno == EAGAIN || errno == EINTR;
+  while (written < iov.size() && (size_t)size >= iov[written].iov_len) {
+    size -= iov[written].iov_len;
+    written++;
+  }
+  if (written < iov.size()) {
+    iov[written].iov_base = (char*)iov[written].iov_base + size;
+    iov[written].iov_len -= size;
+  } else {
+    iov.clear();
+  }
+  return true;
+}
+void ShellFilter::readRows(const char* data, size_t size) {
+  // like loadFromFile, a trailing newline doesn't start an empty row
+  const char* end = data + size;
+  while (data < end) {
+    const char* newline = (const char*)memchr(data, '\n', end - data);
+    const char* rowEnd = newline != nullptr ? newline : end;
+    if (isRowOpen)
+      output.back().append(data, rowEnd);
+    else
+      output.emplace_back(data, rowEnd);
+    isRowOpen = newline == nullptr;
+    data = newline != nullptr ? newline + 1 : end;
+  }
+}
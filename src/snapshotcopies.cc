@@ -0,0 +1,56 @@
+#include <algorithm>
+#include "pane.hh"
+
+namespace {
+enum PieceState { PS_PENDING, PS_COPYING, PS_DONE };
+}  // namespace
+
+SnapshotChunk::~SnapshotChunk() {
+  for (const std::string& row : rows) {
+    MemoryStats::addString(MS_SNAPSHOTS, row, -1);
+  }
+  long long arrayBytes = rows.capacity() * sizeof(std::string);
+  MemoryStats::add(MS_SNAPSHOTS, -arrayBytes, arrayBytes > 0 ? -1 : 0);
+}
+void SnapshotChunk::copy(const std::vector<std::string>& lines,
+                         size_t row,
+                         size_t count) {
+  // chunks are accounted for as long as any snapshot shares them
+  rows.assign(lines.begin() + row, lines.begin() + row + count);
+  long long chunkBytes = rows.capacity() * sizeof(std::string);
+  MemoryStats::add(MS_SNAPSHOTS, chunkBytes, chunkBytes > 0 ? 1 : 0);
+  for (const std::string& line : rows) {
+    chunkBytes += MemoryStats::addString(MS_SNAPSHOTS, line, 1);
+  }
+  bytes = chunkBytes;
+}
+
+SnapshotCopies::SnapshotCopies(const std::vector<std::string>& lines,
+                               std::vector<Piece>&& pieces)
+    : lines{lines}, pieces{std::move(pieces)}, states(this->pieces.size()) {}
+void SnapshotCopies::finish(size_t first, size_t last) {
+  // the first piece ending after first
+  size_t low = std::lower_bound(pieces.begin(), pieces.end(), first,
+                                [](const Piece& piece, size_t row) {
+                                  return piece.row + piece.count <= row;
+                                }) -
+               pieces.begin();
+  size_t high = low;
+  while (high < pieces.size() && pieces[high].row < last) {
+    high++;
+  }
+  forEachShard(high - low, [this, low](size_t i) {
+    int state = PS_PENDING;
+    if (!states[low + i].compare_exchange_strong(state, PS_COPYING))
+      return;
+    const Piece& piece = pieces[low + i];
+    piece.chunk->copy(lines, piece.row, piece.count);
+    states[low + i] = PS_DONE;
+  });
+  // the other side is partway through the rest
+  for (size_t i = low; i < high; i++) {
+    while (states[i] != PS_DONE) {
+      std::this_thread::yield();
+    }
+  }
+}
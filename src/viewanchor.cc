@@ -0,0 +1,60 @@
+#include <algorithm>
+#include "pane.hh"
+
+namespace {
+// where a row ends up once rows [row, row + removed) became
+// [row, row + inserted)
+size_t mapRow(size_t target, size_t row, size_t removed, size_t inserted) {
+  if (target < row)
+    return target;
+  if (target >= row + removed)
+    return target + inserted - removed;
+  return inserted > 0 ? std::min(target, row + inserted - 1) : row;
+}
+}  // namespace
+
+ViewAnchor::ViewAnchor(std::vector<BufferCursor>& cursors,
+                       BufferPosition& offset)
+    : cursors{cursors}, offset{offset} {}
+
+void ViewAnchor::bufferLoaded(const EditBuffer& buf, const std::string&) {
+  if (isEnabled)
+    clamp(buf);
+}
+void ViewAnchor::linesChanged(const EditBuffer& buf,
+                              size_t row,
+                              size_t removed,
+                              size_t inserted) {
+  if (!isEnabled)
+    return;
+  if (removed != inserted) {
+    for (BufferCursor& cursor : cursors) {
+      size_t tailRow = mapRow(cursor.getTailRow(), row, removed, inserted);
+      size_t headRow = mapRow(cursor.getRow(), row, removed, inserted);
+      cursor.moveSet(cursor.getTailCol(), tailRow);
+      cursor.selectSet(cursor.getCol(), headRow);
+    }
+    offset.row = mapRow(offset.row, row, removed, inserted);
+  }
+  clamp(buf);
+}
+void ViewAnchor::rowsReplaced(const EditBuffer& buf,
+                              const std::vector<std::vector<RowChange>>&) {
+  // rows edited in place don't move
+  if (isEnabled)
+    clamp(buf);
+}
+
+void ViewAnchor::clamp(const EditBuffer& buf) {
+  size_t lastRow = buf.lines.size() > 0 ? buf.lines.size() - 1 : 0;
+  auto getLength = [&buf](size_t row) {
+    return row < buf.lines.size() ? buf.lines[row].size() : 0;
+  };
+  for (BufferCursor& cursor : cursors) {
+    size_t tailRow = std::min(cursor.getTailRow(), lastRow);
+    size_t headRow = std::min(cursor.getRow(), lastRow);
+    cursor.moveSet(std::min(cursor.getTailCol(), getLength(tailRow)), tailRow);
+    cursor.selectSet(std::min(cursor.getCol(), getLength(headRow)), headRow);
+  }
+  offset.row = std::min(offset.row, lastRow);
+}
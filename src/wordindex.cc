@@ -0,0 +1,354 @@
+#include <ctype.h>
+#include <algorithm>
+#include <fstream>
+#include <queue>
+#include "pane.hh"
+
+namespace {
+constexpr size_t MIN_WORD_LENGTH = 2;
+constexpr long long WORD_NODE_BYTES = sizeof(WordNode);
+
+long long getWordHeapBytes(const std::string& word) {
+  static const size_t inlineCapacity = std::string{}.capacity();
+  return word.capacity() > inlineCapacity ? word.capacity() + 1 : 0;
+}
+
+bool isWordChar(char c) {
+  return isalnum((unsigned char)c) || c == '_';
+}
+void updateMax(WordNode& node) {
+  node.maxCount = node.count;
+  if (node.left != nullptr)
+    node.maxCount = std::max(node.maxCount, node.left->maxCount);
+  if (node.right != nullptr)
+    node.maxCount = std::max(node.maxCount, node.right->maxCount);
+}
+// the treap is only O(log n) deep, so recursing down it is safe. words before
+// word go left, the rest right
+void splitWords(std::unique_ptr<WordNode> node,
+                const std::string& word,
+                std::unique_ptr<WordNode>& left,
+                std::unique_ptr<WordNode>& right) {
+  if (node == nullptr) {
+    left = nullptr;
+    right = nullptr;
+  } else if (node->word < word) {
+    splitWords(std::move(node->right), word, node->right, right);
+    updateMax(*node);
+    left = std::move(node);
+  } else {
+    splitWords(std::move(node->left), word, left, node->left);
+    updateMax(*node);
+    right = std::move(node);
+  }
+}
+std::unique_ptr<WordNode> mergeWords(std::unique_ptr<WordNode> left,
+                                     std::unique_ptr<WordNode> right) {
+  if (left == nullptr)
+    return right;
+  if (right == nullptr)
+    return left;
+  if (left->priority > right->priority) {
+    left->right = mergeWords(std::move(left->right), std::move(right));
+    updateMax(*left);
+    return left;
+  }
+  right->left = mergeWords(std::move(left), std::move(right->left));
+  updateMax(*right);
+  return right;
+}
+void insertWord(std::unique_ptr<WordNode>& node,
+                std::unique_ptr<WordNode> added) {
+  if (node == nullptr || added->priority > node->priority) {
+    splitWords(std::move(node), added->word, added->left, added->right);
+    node = std::move(added);
+  } else {
+    std::unique_ptr<WordNode>& child =
+        added->word < node->word ? node->left : node->right;
+    insertWord(child, std::move(added));
+  }
+  updateMax(*node);
+}
+// adds delta to the word's count, removing it when none are left. false if
+// it isn't there
+template <typename F>
+bool addToWord(std::unique_ptr<WordNode>& node,
+               const std::string& word,
+               long delta,
+               F removed) {
+  if (node == nullptr)
+    return false;
+  if (word != node->word) {
+    if (!addToWord(word < node->word ? node->left : node->right, word, delta,
+                   removed))
+      return false;
+  } else if ((long)node->count + delta <= 0) {
+    removed(*node);
+    node = mergeWords(std::move(node->left), std::move(node->right));
+    return true;
+  } else {
+    node->count += delta;
+  }
+  if (node != nullptr)
+    updateMax(*node);
+  return true;
+}
+// from words in order, in O(n): the right spine of the tree so far holds the
+// nodes a new one can go under
+std::unique_ptr<WordNode> buildWords(
+    std::vector<std::pair<std::string, size_t>>& counts) {
+  std::unique_ptr<WordNode> root{};
+  std::vector<WordNode*> spine{};
+  for (auto& count : counts) {
+    auto node = std::make_unique<WordNode>();
+    node->word = std::move(count.first);
+    node->count = count.second;
+    node->maxCount = count.second;
+    node->priority = std::hash<std::string>{}(node->word);
+    while (spine.size() > 0 && spine.back()->priority < node->priority) {
+      updateMax(*spine.back());
+      spine.pop_back();
+    }
+    std::unique_ptr<WordNode>& slot = spine.size() > 0 ? spine.back()->right
+                                                       : root;
+    node->left = std::move(slot);
+    slot = std::move(node);
+    spine.push_back(slot.get());
+  }
+  while (spine.size() > 0) {
+    updateMax(*spine.back());
+    spine.pop_back();
+  }
+  return root;
+}
+
+template <typename F>
+void forEachWord(const std::string& line, F f) {
+  size_t i = 0;
+  while (i < line.size()) {
+    if (!isWordChar(line[i])) {
+      i++;
+      continue;
+    }
+    size_t start = i;
+    while (i < line.size() && isWordChar(line[i]))
+      i++;
+    if (i - start >= MIN_WORD_LENGTH)
+      f(line.substr(start, i - start));
+  }
+}
+}  // namespace
+
+WordIndex::~WordIndex() {
+  cancelBuild();
+  clearWords();
+}
+void WordIndex::bufferLoaded(const EditBuffer&, const std::string& filename) {
+  cancelBuild();
+  clearWords();
+  pendingCounts.clear();
+  builtWords = nullptr;
+  isBuilding = true;
+  isBuildDone = false;
+  isBuildCancelled = false;
+  // read the file again instead of the buffer, which the ui thread is free to
+  // edit while we work
+  builder = std::thread([this, filename]() {
+    std::unordered_map<std::string, size_t> counts{};
+    std::ifstream ifile{filename.c_str()};
+    std::string line{};
+    while (!isBuildCancelled && std::getline(ifile, line)) {
+      forEachWord(line, [&counts](std::string word) { counts[word]++; });
+    }
+    std::vector<std::pair<std::string, size_t>> sorted{};
+    sorted.reserve(counts.size());
+    builtMemoryUsage = 0;
+    builtMemoryAllocations = 0;
+    for (auto& word : counts) {
+      long long heapBytes = getWordHeapBytes(word.first);
+      builtMemoryUsage += WORD_NODE_BYTES + heapBytes;
+      builtMemoryAllocations += 1 + (heapBytes > 0);
+      sorted.emplace_back(word.first, word.second);
+    }
+    counts.clear();
+    std::sort(sorted.begin(), sorted.end());
+    builtWords = buildWords(sorted);
+    isBuildDone = true;
+  });
+}
+void WordIndex::linesWillChange(const EditBuffer& buf,
+                                size_t row,
+                                size_t count) {
+  if (row == 0 && count == buf.lines.size() && !isBuilding) {
+    clearWords();
+    return;
+  }
+  for (size_t i = row; i < row + count; i++) {
+    countWords(buf.lines[i], -1);
+  }
+}
+void WordIndex::linesChanged(const EditBuffer& buf,
+                             size_t row,
+                             size_t,
+                             size_t inserted) {
+  for (size_t i = row; i < row + inserted; i++) {
+    countWords(buf.lines[i], 1);
+  }
+}
+void WordIndex::rowsReplaced(
+    const EditBuffer& buf,
+    const std::vector<std::vector<RowChange>>& shards) {
+  // count in parallel, so only the words whose counts changed reach the map
+  std::vector<std::unordered_map<std::string, long>> deltas(shards.size());
+  forEachShard(shards.size(), [&buf, &shards, &deltas](size_t shard) {
+    std::unordered_map<std::string, long>& delta = deltas[shard];
+    for (const RowChange& change : shards[shard]) {
+      const std::string& before = change.text;
+      const std::string& after = buf.lines[change.row];
+      // words wholly inside the unchanged head and tail are the same words
+      size_t head = 0;
+      while (head < before.size() && head < after.size() &&
+             before[head] == after[head])
+        head++;
+      size_t tail = 0;
+      while (tail < before.size() - head && tail < after.size() - head &&
+             before[before.size() - 1 - tail] == after[after.size() - 1 - tail])
+        tail++;
+      while (head > 0 && isWordChar(before[head - 1]))
+        head--;
+      while (tail > 0 && isWordChar(before[before.size() - tail]))
+        tail--;
+      forEachWord(before.substr(head, before.size() - head - tail),
+                  [&delta](std::string word) { delta[word]--; });
+      forEachWord(after.substr(head, after.size() - head - tail),
+                  [&delta](std::string word) { delta[word]++; });
+    }
+  });
+  for (const auto& delta : deltas) {
+    for (const auto& word : delta) {
+      if (word.second != 0)
+        countWord(word.first, word.second);
+    }
+  }
+}
+std::vector<std::string> WordIndex::complete(const std::string& prefix,
+                                             size_t maxResults) {
+  mergeBuild();
+  // the words under the prefix are a range of the treap: whole subtrees
+  // hanging off the paths to its two ends, and the nodes on those paths. they
+  // are searched best first, a subtree by the highest count in it
+  auto isUnder = [&prefix](const WordNode* node) {
+    return node->word.compare(0, prefix.size(), prefix) == 0;
+  };
+  struct Candidate {
+    size_t count{};
+    const WordNode* node{};
+    bool isSubtree{};
+    bool operator<(const Candidate& other) const {
+      return count < other.count;
+    }
+  };
+  std::priority_queue<Candidate> candidates{};
+  auto pushSubtree = [&candidates](const std::unique_ptr<WordNode>& node) {
+    if (node != nullptr)
+      candidates.push(Candidate{node->maxCount, node.get(), true});
+  };
+  const WordNode* top = words.get();
+  while (top != nullptr && !isUnder(top)) {
+    top = (top->word < prefix ? top->right : top->left).get();
+  }
+  if (top != nullptr) {
+    candidates.push(Candidate{top->count, top, false});
+    for (const WordNode* node = top->left.get(); node != nullptr;) {
+      if (!isUnder(node)) {
+        node = node->right.get();
+        continue;
+      }
+      candidates.push(Candidate{node->count, node, false});
+      pushSubtree(node->right);
+      node = node->left.get();
+    }
+    for (const WordNode* node = top->right.get(); node != nullptr;) {
+      if (!isUnder(node)) {
+        node = node->left.get();
+        continue;
+      }
+      candidates.push(Candidate{node->count, node, false});
+      pushSubtree(node->left);
+      node = node->right.get();
+    }
+  }
+  std::vector<std::string> result{};
+  while (result.size() < maxResults && candidates.size() > 0) {
+    Candidate candidate = candidates.top();
+    candidates.pop();
+    const WordNode* node = candidate.node;
+    if (candidate.isSubtree) {
+      candidates.push(Candidate{node->count, node, false});
+      pushSubtree(node->left);
+      pushSubtree(node->right);
+    } else if (node->word.size() > prefix.size()) {
+      result.push_back(node->word);
+    }
+  }
+  return result;
+}
+
+void WordIndex::account(const std::string& word, int sign) {
+  long long heapBytes = getWordHeapBytes(word);
+  long long bytes = sign * (WORD_NODE_BYTES + heapBytes);
+  long long allocations = sign * (1 + (heapBytes > 0));
+  memoryUsage += bytes;
+  memoryAllocations += allocations;
+  MemoryStats::add(MS_WORDS, bytes, allocations);
+}
+void WordIndex::clearWords() {
+  words = nullptr;
+  MemoryStats::add(MS_WORDS, -memoryUsage, -memoryAllocations);
+  memoryUsage = 0;
+  memoryAllocations = 0;
+}
+void WordIndex::cancelBuild() {
+  isBuildCancelled = true;
+  if (builder.joinable())
+    builder.join();
+  isBuilding = false;
+}
+void WordIndex::mergeBuild() {
+  if (!isBuilding || !isBuildDone)
+    return;
+  builder.join();
+  isBuilding = false;
+  words = std::move(builtWords);
+  memoryUsage += builtMemoryUsage;
+  memoryAllocations += builtMemoryAllocations;
+  MemoryStats::add(MS_WORDS, builtMemoryUsage, builtMemoryAllocations);
+  for (auto& pending : pendingCounts) {
+    if (pending.second != 0)
+      countWords(pending.first, pending.second);
+  }
+  pendingCounts.clear();
+}
+void WordIndex::countWords(const std::string& line, long delta) {
+  forEachWord(line, [this, delta](std::string word) {
+    countWord(std::move(word), delta);
+  });
+}
+void WordIndex::countWord(std::string word, long delta) {
+  mergeBuild();
+  if (isBuilding) {
+    pendingCounts[word] += delta;
+    return;
+  }
+  bool isFound = addToWord(words, word, delta, [this](const WordNode& node) {
+    account(node.word, -1);
+  });
+  if (isFound || delta <= 0)
+    return;
+  auto node = std::make_unique<WordNode>();
+  node->word = std::move(word);
+  node->count = delta;
+  node->priority = std::hash<std::string>{}(node->word);
+  account(node->word, 1);
+  insertWord(words, std::move(node));
+}
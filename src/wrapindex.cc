@@ -0,0 +1,119 @@
+#include <algorithm>
+#include "const.hh"
+#include "pane.hh"
+
+namespace {
+constexpr size_t WRAP_SHARD_ROWS = 16384;
+
+// calls f(start) with the column every screen row of line but the first
+// starts at
+template <typename F>
+void forEachBreak(const std::string& line, size_t width, F f) {
+  size_t start = 0;
+  size_t screenX = 0;
+  size_t lastBlank = std::string::npos;
+  for (size_t i = 0; i < line.size(); i++) {
+    size_t cellWidth =
+        line[i] == '\t' ? TABSTOPWIDTH - (screenX % TABSTOPWIDTH) : 1;
+    if (screenX + cellWidth > width && i > start) {
+      // the character doesn't fit, so the screen row ends after the last
+      // blank or right before it
+      start = lastBlank != std::string::npos ? lastBlank + 1 : i;
+      f(start);
+      screenX = 0;
+      lastBlank = std::string::npos;
+      i = start - 1;
+      continue;
+    }
+    screenX += cellWidth;
+    if (line[i] == ' ' || line[i] == '\t')
+      lastBlank = i;
+  }
+}
+}  // namespace
+
+void WrapIndex::setWidth(const EditBuffer& buf, size_t newWidth) {
+  if (newWidth != width)
+    reset(buf, newWidth);
+}
+void WrapIndex::reset(const EditBuffer& buf, size_t newWidth) {
+  width = newWidth;
+  if (width == 0) {
+    counts.assign({});
+    return;
+  }
+  std::vector<size_t> rowCounts(buf.lines.size());
+  size_t shardCount =
+      (buf.lines.size() + WRAP_SHARD_ROWS - 1) / WRAP_SHARD_ROWS;
+  forEachShard(shardCount, [this, &buf, &rowCounts](size_t shard) {
+    size_t end = std::min((shard + 1) * WRAP_SHARD_ROWS, buf.lines.size());
+    for (size_t i = shard * WRAP_SHARD_ROWS; i < end; i++) {
+      rowCounts[i] = countScreenRows(buf.lines[i]);
+    }
+  });
+  counts.assign(std::move(rowCounts));
+}
+size_t WrapIndex::getWidth() const {
+  return width;
+}
+void WrapIndex::bufferLoaded(const EditBuffer& buf, const std::string&) {
+  reset(buf, width);
+}
+void WrapIndex::linesChanged(const EditBuffer& buf,
+                             size_t row,
+                             size_t removed,
+                             size_t inserted) {
+  if (width == 0)
+    return;
+  if (removed != inserted)
+    counts.splice(row, removed, inserted);
+  for (size_t i = row; i < row + inserted; i++) {
+    counts.set(i, countScreenRows(buf.lines[i]));
+  }
+}
+void WrapIndex::linesRotated(const EditBuffer& buf,
+                             size_t first,
+                             size_t,
+                             size_t last) {
+  if (width == 0)
+    return;
+  for (size_t i = first; i < last; i++) {
+    counts.set(i, countScreenRows(buf.lines[i]));
+  }
+}
+size_t WrapIndex::getScreenRow(size_t row) const {
+  return counts.getSum(row);
+}
+size_t WrapIndex::getRow(size_t screenRow, size_t& segment) const {
+  size_t row = counts.find(screenRow);
+  if (row >= counts.size()) {
+    // past the end, onto the last screen row
+    if (row == 0) {
+      segment = 0;
+      return 0;
+    }
+    segment = counts.get(row - 1) - 1;
+    return row - 1;
+  }
+  segment = screenRow;
+  return row;
+}
+size_t WrapIndex::getScreenRowCount() const {
+  return counts.getSum(counts.size());
+}
+void WrapIndex::getBreaks(const std::string& line,
+                          size_t width,
+                          std::vector<size_t>& breaks) {
+  breaks.clear();
+  forEachBreak(line, width,
+               [&breaks](size_t start) { breaks.push_back(start); });
+}
+
+size_t WrapIndex::countScreenRows(const std::string& line) const {
+  // most rows fit without wrapping, tabs and all
+  if (line.size() * TABSTOPWIDTH <= width)
+    return 1;
+  size_t count = 1;
+  forEachBreak(line, width, [&count](size_t) { count++; });
+  return count;
+}